@@ -0,0 +1,202 @@
+#include "alias_table.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "jobs.h"
+#include "vulkan/utils.h"
+
+// Enough items per batch to amortize the job overhead of the O(n) passes
+constexpr size_t ALIAS_TABLE_MIN_BATCH = 4096;
+
+void AliasTable::build(const std::span<const float> weights) {
+    SCOPED_TIMER();
+
+    const size_t count = weights.size();
+    entries.assign(count, AliasEntry{});
+    if (count == 0) return;
+
+    const uint32_t block_count = JobSystem::get_thread_count();
+    const size_t block_size = (count + block_count - 1) / block_count;
+
+    auto for_each_block = [&](const std::function<void(uint32_t block, size_t begin, size_t end)>& fn) {
+        JobSystem::parallel_for(block_count, 1, [&](const size_t first_block, const size_t last_block) {
+            for (size_t block = first_block; block < last_block; ++block) {
+                const size_t begin = std::min(block * block_size, count);
+                const size_t end = std::min(begin + block_size, count);
+                fn(static_cast<uint32_t>(block), begin, end);
+            }
+        });
+    };
+
+    // Total weight and light/heavy counts per block
+    std::vector<double> block_weights(block_count, 0.0);
+    for_each_block([&](const uint32_t block, const size_t begin, const size_t end) {
+        double sum = 0.0;
+        for (size_t i = begin; i < end; ++i) {
+            sum += weights[i];
+        }
+        block_weights[block] = sum;
+    });
+
+    double total_weight = 0.0;
+    for (const double block_weight : block_weights) {
+        total_weight += block_weight;
+    }
+
+    if (total_weight <= 0.0) {
+        JobSystem::parallel_for(count, ALIAS_TABLE_MIN_BATCH, [&](const size_t begin, const size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                entries[i] = {.probability = 1.0f, .alias = static_cast<uint32_t>(i), .pmf = 1.0f / count};
+            }
+        });
+        return;
+    }
+
+    // Weights scaled so the average is one, items below are light and items above are heavy
+    const double scale = static_cast<double>(count) / total_weight;
+    std::vector<double> q(count);
+    std::vector<uint32_t> block_light_counts(block_count, 0);
+    for_each_block([&](const uint32_t block, const size_t begin, const size_t end) {
+        uint32_t light_count = 0;
+        for (size_t i = begin; i < end; ++i) {
+            q[i] = weights[i] * scale;
+            entries[i].pmf = static_cast<float>(weights[i] / total_weight);
+            if (q[i] < 1.0) light_count++;
+        }
+        block_light_counts[block] = light_count;
+    });
+
+    std::vector<size_t> block_light_offsets(block_count);
+    std::vector<size_t> block_heavy_offsets(block_count);
+    size_t light_total = 0;
+    size_t heavy_total = 0;
+    for (uint32_t block = 0; block < block_count; ++block) {
+        const size_t begin = std::min(block * block_size, count);
+        const size_t end = std::min(begin + block_size, count);
+        block_light_offsets[block] = light_total;
+        block_heavy_offsets[block] = heavy_total;
+        light_total += block_light_counts[block];
+        heavy_total += (end - begin) - block_light_counts[block];
+    }
+
+    // Light and heavy items in index order, with the prefix sums of their deficits and excesses
+    std::vector<uint32_t> lights(light_total);
+    std::vector<uint32_t> heavies(heavy_total);
+    std::vector<double> light_prefix(light_total + 1, 0.0);
+    std::vector<double> heavy_prefix(heavy_total + 1, 0.0);
+    std::vector<double> block_deficits(block_count, 0.0);
+    std::vector<double> block_excesses(block_count, 0.0);
+
+    for_each_block([&](const uint32_t block, const size_t begin, const size_t end) {
+        size_t light = block_light_offsets[block];
+        size_t heavy = block_heavy_offsets[block];
+        double deficit = 0.0;
+        double excess = 0.0;
+        for (size_t i = begin; i < end; ++i) {
+            if (q[i] < 1.0) {
+                lights[light] = static_cast<uint32_t>(i);
+                deficit += 1.0 - q[i];
+                light_prefix[++light] = deficit;
+            } else {
+                heavies[heavy] = static_cast<uint32_t>(i);
+                excess += q[i] - 1.0;
+                heavy_prefix[++heavy] = excess;
+            }
+        }
+        block_deficits[block] = deficit;
+        block_excesses[block] = excess;
+    });
+
+    double deficit_base = 0.0;
+    double excess_base = 0.0;
+    for (uint32_t block = 0; block < block_count; ++block) {
+        const double deficit = block_deficits[block];
+        const double excess = block_excesses[block];
+        block_deficits[block] = deficit_base;
+        block_excesses[block] = excess_base;
+        deficit_base += deficit;
+        excess_base += excess;
+    }
+
+    for_each_block([&](const uint32_t block, size_t, size_t) {
+        const size_t light_begin = block_light_offsets[block];
+        const size_t light_end = light_begin + block_light_counts[block];
+        for (size_t l = light_begin; l < light_end; ++l) {
+            light_prefix[l + 1] += block_deficits[block];
+        }
+
+        const size_t heavy_begin = block_heavy_offsets[block];
+        const size_t heavy_end = block + 1 < block_count ? block_heavy_offsets[block + 1] : heavy_total;
+        for (size_t h = heavy_begin; h < heavy_end; ++h) {
+            heavy_prefix[h + 1] += block_excesses[block];
+        }
+    });
+
+    if (heavy_total == 0 || light_total == 0) {
+        JobSystem::parallel_for(count, ALIAS_TABLE_MIN_BATCH, [&](const size_t begin, const size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                entries[i].probability = 1.0f;
+                entries[i].alias = static_cast<uint32_t>(i);
+            }
+        });
+        return;
+    }
+
+    // Light i is served by the first heavy j with heavy_prefix[j + 1] > light_prefix[i], so every chunk of
+    // light items can locate its starting heavy item by binary search and sweep independently
+    const size_t last_heavy = heavy_total - 1;
+    std::vector<size_t> chunk_end_heavies(block_count, 0);
+
+    JobSystem::parallel_for(block_count, 1, [&](const size_t first_chunk, const size_t last_chunk) {
+        for (size_t chunk = first_chunk; chunk < last_chunk; ++chunk) {
+            const size_t light_begin = light_total * chunk / block_count;
+            const size_t light_end = light_total * (chunk + 1) / block_count;
+            if (light_begin == light_end) continue;
+
+            // Start from the heavy item that served the previous chunk's last light, the loop below drains it
+            size_t heavy = 0;
+            if (light_begin > 0) {
+                heavy = std::upper_bound(heavy_prefix.begin() + 1, heavy_prefix.end(), light_prefix[light_begin - 1]) -
+                        (heavy_prefix.begin() + 1);
+                heavy = std::min(heavy, last_heavy);
+            }
+            double w = 1.0 + heavy_prefix[heavy + 1] - light_prefix[light_begin];
+
+            for (size_t l = light_begin; l < light_end; ++l) {
+                // Drained heavy items become light and take the next heavy item as their alias
+                while (w <= 1.0 && heavy < last_heavy) {
+                    const uint32_t index = heavies[heavy];
+                    entries[index].probability = static_cast<float>(std::max(w, 0.0));
+                    entries[index].alias = heavies[heavy + 1];
+                    heavy++;
+                    w = 1.0 + heavy_prefix[heavy + 1] - light_prefix[l];
+                }
+
+                const uint32_t index = lights[l];
+                entries[index].probability = static_cast<float>(q[index]);
+                entries[index].alias = heavies[heavy];
+                w -= 1.0 - q[index];
+            }
+
+            chunk_end_heavies[chunk] = heavy;
+        }
+    });
+
+    // After the last light the remaining heavy items drain into each other, the last one keeps the leftover
+    const size_t first_tail_heavy = *std::max_element(chunk_end_heavies.begin(), chunk_end_heavies.end());
+    const double total_deficit = light_prefix[light_total];
+    JobSystem::parallel_for(heavy_total - first_tail_heavy, ALIAS_TABLE_MIN_BATCH, [&](const size_t begin, const size_t end) {
+        for (size_t h = first_tail_heavy + begin; h < first_tail_heavy + end; ++h) {
+            const uint32_t index = heavies[h];
+            if (h == last_heavy) {
+                entries[index].probability = 1.0f;
+                entries[index].alias = index;
+            } else {
+                const double w = 1.0 + heavy_prefix[h + 1] - total_deficit;
+                entries[index].probability = static_cast<float>(std::clamp(w, 0.0, 1.0));
+                entries[index].alias = heavies[h + 1];
+            }
+        }
+    });
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "common.h"
+
+/**
+ * Walker alias table, built with the parallel sweeping algorithm
+ * Source: Hübschle-Schneider and Sanders 2019, "Parallel Weighted Random Sampling"
+ * Section 4.2
+ * Web: https://arxiv.org/abs/1903.00227
+ */
+class AliasTable {
+    std::vector<AliasEntry> entries;
+
+public:
+    // Weights must be non-negative, an all-zero input produces a uniform table
+    void build(std::span<const float> weights);
+
+    [[nodiscard]] const std::vector<AliasEntry>& get_entries() const {
+        return entries;
+    }
+};
\ No newline at end of file
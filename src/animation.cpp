@@ -0,0 +1,94 @@
+#include "animation.h"
+
+#include <algorithm>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+glm::mat4 HierarchyNode::local_transform() const {
+    return glm::translate(glm::mat4(1.0f), translation) *
+           glm::mat4_cast(rotation) *
+           glm::scale(glm::mat4(1.0f), scale);
+}
+
+void AnimationSampler::sample(const float time, const AnimationPath path, float* out) const {
+    const size_t key_count = times.size();
+    const bool cubic = interpolation == AnimationInterpolation::CubicSpline;
+    // Cubic spline keys are stored as [in-tangent, value, out-tangent]
+    const size_t key_stride = cubic ? stride * 3 : stride;
+    const size_t value_offset = cubic ? stride : 0;
+
+    auto key_value = [&](const size_t key) {
+        return values.data() + key * key_stride + value_offset;
+    };
+
+    if (key_count == 0) return;
+
+    if (key_count == 1 || time <= times.front()) {
+        std::copy_n(key_value(0), stride, out);
+        return;
+    }
+    if (time >= times.back()) {
+        std::copy_n(key_value(key_count - 1), stride, out);
+        return;
+    }
+
+    const size_t next = std::upper_bound(times.begin(), times.end(), time) - times.begin();
+    const size_t prev = next - 1;
+
+    const float t0 = times[prev];
+    const float t1 = times[next];
+    const float dt = t1 - t0;
+    const float t = dt > 0.0f ? (time - t0) / dt : 0.0f;
+
+    switch (interpolation) {
+        case AnimationInterpolation::Step:
+            std::copy_n(key_value(prev), stride, out);
+            return;
+
+        case AnimationInterpolation::Linear:
+            if (path == AnimationPath::Rotation) {
+                const float* a = key_value(prev);
+                const float* b = key_value(next);
+                const glm::quat qa(a[3], a[0], a[1], a[2]);
+                const glm::quat qb(b[3], b[0], b[1], b[2]);
+                const glm::quat q = glm::normalize(glm::slerp(qa, qb, t));
+                out[0] = q.x;
+                out[1] = q.y;
+                out[2] = q.z;
+                out[3] = q.w;
+                return;
+            }
+            for (uint32_t i = 0; i < stride; ++i) {
+                out[i] = glm::mix(key_value(prev)[i], key_value(next)[i], t);
+            }
+            return;
+
+        case AnimationInterpolation::CubicSpline: {
+            // glTF 2.0 spec, Appendix C: Hermite spline with tangents scaled by the key interval
+            const float t2 = t * t;
+            const float t3 = t2 * t;
+            const float h00 = 2.0f * t3 - 3.0f * t2 + 1.0f;
+            const float h10 = t3 - 2.0f * t2 + t;
+            const float h01 = -2.0f * t3 + 3.0f * t2;
+            const float h11 = t3 - t2;
+
+            const float* p0 = key_value(prev);
+            const float* p1 = key_value(next);
+            const float* out_tangent = values.data() + prev * key_stride + 2 * stride;
+            const float* in_tangent = values.data() + next * key_stride;
+
+            for (uint32_t i = 0; i < stride; ++i) {
+                out[i] = h00 * p0[i] + h10 * dt * out_tangent[i] + h01 * p1[i] + h11 * dt * in_tangent[i];
+            }
+
+            if (path == AnimationPath::Rotation) {
+                const glm::quat q = glm::normalize(glm::quat(out[3], out[0], out[1], out[2]));
+                out[0] = q.x;
+                out[1] = q.y;
+                out[2] = q.z;
+                out[3] = q.w;
+            }
+            return;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+enum class AnimationPath : uint8_t {
+    Translation = 0,
+    Rotation = 1,
+    Scale = 2,
+    Weights = 3
+};
+
+enum class AnimationInterpolation : uint8_t {
+    Linear = 0,
+    Step = 1,
+    CubicSpline = 2
+};
+
+struct AnimationSampler {
+    std::vector<float> times;
+    // Keyframe values, `stride` floats per key (x3 for cubic splines: in-tangent, value, out-tangent)
+    std::vector<float> values;
+    uint32_t stride;
+    AnimationInterpolation interpolation;
+
+    // Writes `stride` floats into out
+    void sample(float time, AnimationPath path, float* out) const;
+};
+
+struct AnimationChannel {
+    uint32_t sampler;
+    uint32_t node;
+    AnimationPath path;
+};
+
+struct Animation {
+    std::string name;
+    std::vector<AnimationSampler> samplers;
+    std::vector<AnimationChannel> channels;
+    float duration = 0.0f;
+};
+
+// Local TRS of a glTF node, indexed by the glTF node index
+struct HierarchyNode {
+    uint32_t parent = UINT32_MAX;
+    glm::vec3 translation = glm::vec3(0.0f);
+    glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    glm::vec3 scale = glm::vec3(1.0f);
+    std::vector<float> weights; // Morph target weights of the node's mesh
+
+    [[nodiscard]] glm::mat4 local_transform() const;
+};
+
+struct Pose {
+    // Global transform and morph target weights of every glTF node
+    std::vector<glm::mat4> node_transforms;
+    std::vector<std::vector<float>> node_weights;
+};
\ No newline at end of file
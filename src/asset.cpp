@@ -43,6 +43,6 @@ std::shared_ptr<Model> AssetManager::get_model(std::filesystem::path path) {
         spdlog::info(" - " + ext);
     }
 
-    models_cache[path] = std::make_shared<Model>(asset);
+    models_cache[path] = std::make_shared<Model>(asset, conditioning);
     return models_cache[path];
 }
\ No newline at end of file
@@ -3,12 +3,21 @@
 #include <filesystem>
 #include <unordered_map>
 
+#include "conditioning.h"
+
 class Model;
 
 class AssetManager {
     std::unordered_map<std::filesystem::path, std::shared_ptr<Model>> models_cache;
+    ConditioningSettings conditioning;
 
 public:
     AssetManager() = default;
+
+    // Applies to models loaded from disk afterwards
+    void set_conditioning(const ConditioningSettings& settings) {
+        conditioning = settings;
+    }
+
     std::shared_ptr<Model> get_model(std::filesystem::path path);
 };
\ No newline at end of file
@@ -0,0 +1,391 @@
+#include "conditioning.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <queue>
+#include <unordered_map>
+
+#include "model.h"
+
+constexpr float DEGENERATE_EPSILON = 1e-6f; // Height relative to the longest edge below which a triangle is a line
+constexpr float MIN_SPLIT_WASTE = 4.0f; // Bounding box area per unit of triangle area left alone by pre-splitting
+constexpr float WELD_PRECISION = 1.0f / (1 << 20); // Of the primitive extent, closer positions share split edges
+
+constexpr uint32_t SAH_BINS = 16;
+constexpr uint32_t SAH_MAX_LEAF_SIZE = 16;
+constexpr float SAH_TRAVERSAL_COST = 1.0f;
+constexpr float SAH_INTERSECTION_COST = 1.0f;
+
+struct Bounds {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+    void grow(const glm::vec3& p) {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    void grow(const Bounds& b) {
+        min = glm::min(min, b.min);
+        max = glm::max(max, b.max);
+    }
+
+    [[nodiscard]] float area() const {
+        if (min.x > max.x) return 0.0f;
+        const glm::vec3 d = max - min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+};
+
+Bounds triangle_bounds(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    Bounds bounds;
+    bounds.grow(a);
+    bounds.grow(b);
+    bounds.grow(c);
+    return bounds;
+}
+
+bool is_degenerate(const std::vector<Vertex>& vertices, const uint32_t* triangle) {
+    if (triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[2] == triangle[0]) return true;
+
+    const glm::vec3& a = vertices[triangle[0]].position;
+    const glm::vec3& b = vertices[triangle[1]].position;
+    const glm::vec3& c = vertices[triangle[2]].position;
+    const float longest = std::max({glm::length(b - a), glm::length(c - b), glm::length(a - c)});
+    return glm::length(glm::cross(b - a, c - a)) <= DEGENERATE_EPSILON * longest * longest;
+}
+
+// Bounding box area a triangle adds over the best case of an axis aligned right triangle, 4x its own area
+float split_priority(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    const float area = 0.5f * glm::length(glm::cross(b - a, c - a));
+    const float box_area = triangle_bounds(a, b, c).area();
+    if (box_area <= MIN_SPLIT_WASTE * area) return 0.0f;
+    return box_area - MIN_SPLIT_WASTE * area;
+}
+
+void remove_degenerates(Primitive& primitive, ConditioningReport& report) {
+    size_t kept = 0;
+    for (size_t i = 0; i + 2 < primitive.indices.size(); i += 3) {
+        if (is_degenerate(primitive.vertices, &primitive.indices[i])) {
+            ++report.degenerate_triangles;
+            continue;
+        }
+        std::copy_n(primitive.indices.begin() + i, 3, primitive.indices.begin() + kept);
+        kept += 3;
+    }
+    primitive.indices.resize(kept);
+}
+
+// Midpoint of an edge shared by both triangles that split it, so neighbours do not get different vertices. Seam
+// neighbours with their own vertices get their own midpoint, all placed at the same split point
+uint32_t edge_midpoint(Primitive& primitive,
+                       std::unordered_map<uint64_t, uint32_t>& midpoints,
+                       std::vector<std::array<uint32_t, 2>>& parents,
+                       const uint32_t a,
+                       const uint32_t b,
+                       const glm::vec3& split_point) {
+    const uint64_t key = static_cast<uint64_t>(std::min(a, b)) << 32 | std::max(a, b);
+    if (const auto it = midpoints.find(key); it != midpoints.end()) {
+        return it->second;
+    }
+
+    const Vertex& va = primitive.vertices[a];
+    const Vertex& vb = primitive.vertices[b];
+
+    Vertex midpoint = va;
+    midpoint.position = split_point;
+    midpoint.texcoord = 0.5f * (va.texcoord + vb.texcoord);
+    const glm::vec3 normal = va.normal + vb.normal;
+    if (glm::dot(normal, normal) > 0.0f) midpoint.normal = glm::normalize(normal);
+    const glm::vec3 tangent = glm::vec3(va.tangent) + glm::vec3(vb.tangent);
+    if (glm::dot(tangent, tangent) > 0.0f) midpoint.tangent = glm::vec4(glm::normalize(tangent), va.tangent.w);
+
+    const auto index = static_cast<uint32_t>(primitive.vertices.size());
+    primitive.vertices.push_back(midpoint);
+    parents.push_back({a, b});
+    midpoints.emplace(key, index);
+    return index;
+}
+
+// Grid positions are snapped to, so seam vertices duplicated for their own normals or UVs still share edges
+glm::ivec3 weld_key(const glm::vec3& position, const float cell) {
+    return glm::ivec3(glm::round(position / cell));
+}
+
+// Same for both directions of the edge
+uint64_t hash_edge(const glm::ivec3& a, const glm::ivec3& b) {
+    const auto hash = [](const glm::ivec3& key) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (int i = 0; i < 3; ++i) {
+            h = (h ^ static_cast<uint32_t>(key[i])) * 0x100000001b3ull;
+        }
+        return h;
+    };
+    const uint64_t ha = hash(a);
+    const uint64_t hb = hash(b);
+    return std::min(ha, hb) * 0x9e3779b97f4a7c15ull ^ std::max(ha, hb);
+}
+
+// Every triangle on the split edge is split with it, found through edges keyed on welded positions, so no neighbour
+// is left with a T-junction that could open a crack
+void split_triangles(Primitive& primitive, const size_t budget, ConditioningReport& report) {
+    struct Candidate {
+        float priority;
+        uint32_t triangle;
+
+        bool operator<(const Candidate& other) const {
+            return priority < other.priority;
+        }
+    };
+
+    Bounds bounds;
+    for (const auto& vertex : primitive.vertices) {
+        bounds.grow(vertex.position);
+    }
+    const glm::vec3 extent = bounds.max - bounds.min;
+    const float weld_cell = std::max({extent.x, extent.y, extent.z, DEGENERATE_EPSILON}) * WELD_PRECISION;
+
+    const auto position = [&](const uint32_t triangle, const int corner) -> const glm::vec3& {
+        return primitive.vertices[primitive.indices[triangle * 3 + corner]].position;
+    };
+    const auto priority = [&](const uint32_t triangle) {
+        return split_priority(position(triangle, 0), position(triangle, 1), position(triangle, 2));
+    };
+    const auto corner_key = [&](const uint32_t triangle, const int corner) {
+        return weld_key(position(triangle, corner), weld_cell);
+    };
+
+    // Triangles of every edge, by the edge from each corner to the next
+    std::unordered_map<uint64_t, std::vector<uint32_t>> edge_triangles;
+    const auto add_edges = [&](const uint32_t triangle) {
+        for (int i = 0; i < 3; ++i) {
+            edge_triangles[hash_edge(corner_key(triangle, i), corner_key(triangle, (i + 1) % 3))].push_back(triangle);
+        }
+    };
+    const auto remove_edges = [&](const uint32_t triangle) {
+        for (int i = 0; i < 3; ++i) {
+            auto& triangles = edge_triangles[hash_edge(corner_key(triangle, i), corner_key(triangle, (i + 1) % 3))];
+            std::erase(triangles, triangle);
+        }
+    };
+
+    std::priority_queue<Candidate> queue;
+    const auto triangle_count = static_cast<uint32_t>(primitive.indices.size() / 3);
+    for (uint32_t triangle = 0; triangle < triangle_count; ++triangle) {
+        add_edges(triangle);
+        if (const float p = priority(triangle); p > 0.0f) queue.push({p, triangle});
+    }
+
+    const size_t original_vertex_count = primitive.vertices.size();
+    std::unordered_map<uint64_t, uint32_t> midpoints;
+    std::vector<std::array<uint32_t, 2>> parents; // Of every added vertex, for the morph deltas
+
+    size_t splits = 0;
+    while (splits < budget && !queue.empty()) {
+        const auto [queued_priority, triangle] = queue.top();
+        queue.pop();
+        // Neighbours split along with another triangle left their old entry behind
+        if (priority(triangle) != queued_priority) continue;
+
+        int longest = 0;
+        float longest_length = -1.0f;
+        for (int i = 0; i < 3; ++i) {
+            const float length = glm::length(position(triangle, (i + 1) % 3) - position(triangle, i));
+            if (length > longest_length) {
+                longest = i;
+                longest_length = length;
+            }
+        }
+        const glm::ivec3 edge_a = corner_key(triangle, longest);
+        const glm::ivec3 edge_b = corner_key(triangle, (longest + 1) % 3);
+        const std::vector<uint32_t> sharing = edge_triangles[hash_edge(edge_a, edge_b)];
+        const glm::vec3 split_point = 0.5f * (position(triangle, longest) + position(triangle, (longest + 1) % 3));
+
+        for (const uint32_t shared : sharing) {
+            // Rotate the corners so the split edge runs from the first to the second one, in either direction
+            int edge = -1;
+            for (int i = 0; i < 3 && edge < 0; ++i) {
+                const glm::ivec3 a = corner_key(shared, i);
+                const glm::ivec3 b = corner_key(shared, (i + 1) % 3);
+                if ((a == edge_a && b == edge_b) || (a == edge_b && b == edge_a)) edge = i;
+            }
+            if (edge < 0) continue; // Hash collision
+
+            const uint32_t a = primitive.indices[shared * 3 + edge];
+            const uint32_t b = primitive.indices[shared * 3 + (edge + 1) % 3];
+            const uint32_t c = primitive.indices[shared * 3 + (edge + 2) % 3];
+            const uint32_t m = edge_midpoint(primitive, midpoints, parents, a, b, split_point);
+
+            remove_edges(shared);
+            const auto added = static_cast<uint32_t>(primitive.indices.size() / 3);
+            primitive.indices[shared * 3 + 0] = a;
+            primitive.indices[shared * 3 + 1] = m;
+            primitive.indices[shared * 3 + 2] = c;
+            primitive.indices.insert(primitive.indices.end(), {m, b, c});
+            add_edges(shared);
+            add_edges(added);
+            ++splits;
+
+            if (const float p = priority(shared); p > 0.0f) queue.push({p, shared});
+            if (const float p = priority(added); p > 0.0f) queue.push({p, added});
+        }
+    }
+
+    report.split_triangles += splits;
+    if (primitive.morph_target_count == 0 || parents.empty()) return;
+
+    // Morph deltas are target-major, every target gets the interpolated deltas of the added vertices
+    const size_t vertex_count = primitive.vertices.size();
+    std::vector<MorphDelta> deltas(primitive.morph_target_count * vertex_count);
+    for (uint32_t target = 0; target < primitive.morph_target_count; ++target) {
+        MorphDelta* dst = deltas.data() + target * vertex_count;
+        std::copy_n(primitive.morph_deltas.begin() + target * original_vertex_count, original_vertex_count, dst);
+        for (size_t i = 0; i < parents.size(); ++i) {
+            const MorphDelta& da = dst[parents[i][0]];
+            const MorphDelta& db = dst[parents[i][1]];
+            dst[original_vertex_count + i].position = 0.5f * (da.position + db.position);
+            dst[original_vertex_count + i].normal = 0.5f * (da.normal + db.normal);
+        }
+    }
+    primitive.morph_deltas = std::move(deltas);
+}
+
+ConditioningReport condition_mesh(Mesh& mesh, const ConditioningSettings& settings) {
+    ConditioningReport report;
+    for (const auto& primitive : mesh.primitives) {
+        report.input_triangles += primitive.indices.size() / 3;
+    }
+
+    if (settings.split_budget > 0.0f) {
+        report.sah_before = estimate_sah_cost(mesh);
+    }
+
+    for (auto& primitive : mesh.primitives) {
+        if (settings.remove_degenerates) {
+            remove_degenerates(primitive, report);
+        }
+        if (settings.split_budget > 0.0f && primitive.skin.empty()) {
+            const auto budget = static_cast<size_t>(settings.split_budget * static_cast<float>(primitive.indices.size() / 3));
+            split_triangles(primitive, budget, report);
+        }
+    }
+
+    if (settings.split_budget > 0.0f) {
+        report.sah_after = estimate_sah_cost(mesh);
+    }
+
+    return report;
+}
+
+float estimate_sah_cost(const Mesh& mesh) {
+    struct Item {
+        Bounds bounds;
+        glm::vec3 centroid;
+    };
+
+    std::vector<Item> items;
+    Bounds root;
+    for (const auto& primitive : mesh.primitives) {
+        for (size_t i = 0; i + 2 < primitive.indices.size(); i += 3) {
+            const Bounds bounds = triangle_bounds(primitive.vertices[primitive.indices[i + 0]].position,
+                                                  primitive.vertices[primitive.indices[i + 1]].position,
+                                                  primitive.vertices[primitive.indices[i + 2]].position);
+            items.push_back({bounds, 0.5f * (bounds.min + bounds.max)});
+            root.grow(bounds);
+        }
+    }
+
+    const float root_area = root.area();
+    if (items.empty() || root_area <= 0.0f) return 0.0f;
+
+    struct Range {
+        size_t begin;
+        size_t end;
+        Bounds bounds;
+    };
+
+    // Top-down binned build, iterative so that badly distributed meshes cannot overflow the stack
+    float cost = 0.0f;
+    std::vector<Range> stack{{0, items.size(), root}};
+    while (!stack.empty()) {
+        const Range range = stack.back();
+        stack.pop_back();
+
+        const size_t count = range.end - range.begin;
+        const float area = range.bounds.area();
+        const float leaf_cost = area * SAH_INTERSECTION_COST * static_cast<float>(count);
+
+        Bounds centroid_bounds;
+        for (size_t i = range.begin; i < range.end; ++i) {
+            centroid_bounds.grow(items[i].centroid);
+        }
+        const glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+        const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+        if (count <= 1 || extent[axis] <= 0.0f) {
+            cost += leaf_cost;
+            continue;
+        }
+
+        std::array<Bounds, SAH_BINS> bin_bounds{};
+        std::array<size_t, SAH_BINS> bin_counts{};
+        const float scale = static_cast<float>(SAH_BINS) / extent[axis];
+        const auto bin_of = [&](const Item& item) {
+            const auto bin = static_cast<uint32_t>((item.centroid[axis] - centroid_bounds.min[axis]) * scale);
+            return std::min(bin, SAH_BINS - 1);
+        };
+        for (size_t i = range.begin; i < range.end; ++i) {
+            const uint32_t bin = bin_of(items[i]);
+            bin_bounds[bin].grow(items[i].bounds);
+            ++bin_counts[bin];
+        }
+
+        // Right-to-left sweep, then the left-to-right sweep picks the cheapest plane
+        std::array<float, SAH_BINS> right_costs{};
+        Bounds right;
+        size_t right_count = 0;
+        for (uint32_t bin = SAH_BINS - 1; bin > 0; --bin) {
+            right.grow(bin_bounds[bin]);
+            right_count += bin_counts[bin];
+            right_costs[bin] = right.area() * static_cast<float>(right_count);
+        }
+
+        float best_cost = std::numeric_limits<float>::max();
+        uint32_t best_bin = 1;
+        Bounds left;
+        size_t left_count = 0;
+        for (uint32_t bin = 1; bin < SAH_BINS; ++bin) {
+            left.grow(bin_bounds[bin - 1]);
+            left_count += bin_counts[bin - 1];
+            const float split_cost = left.area() * static_cast<float>(left_count) + right_costs[bin];
+            if (left_count > 0 && left_count < count && split_cost < best_cost) {
+                best_cost = split_cost;
+                best_bin = bin;
+            }
+        }
+
+        const float total_split_cost = SAH_TRAVERSAL_COST * area + SAH_INTERSECTION_COST * best_cost;
+        if (best_cost == std::numeric_limits<float>::max() ||
+            (total_split_cost >= leaf_cost && count <= SAH_MAX_LEAF_SIZE)) {
+            cost += leaf_cost;
+            continue;
+        }
+
+        const auto middle = std::partition(items.begin() + range.begin, items.begin() + range.end, [&](const Item& item) {
+            return bin_of(item) < best_bin;
+        });
+        const auto split = static_cast<size_t>(middle - items.begin());
+
+        Bounds left_bounds;
+        Bounds right_bounds;
+        for (size_t i = range.begin; i < split; ++i) left_bounds.grow(items[i].bounds);
+        for (size_t i = split; i < range.end; ++i) right_bounds.grow(items[i].bounds);
+
+        cost += SAH_TRAVERSAL_COST * area;
+        stack.push_back({range.begin, split, left_bounds});
+        stack.push_back({split, range.end, right_bounds});
+    }
+
+    return cost / root_area;
+}
\ No newline at end of file
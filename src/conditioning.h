@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct Mesh;
+
+struct ConditioningSettings {
+    bool remove_degenerates = true;
+    float split_budget = 0.0f; // Triangles added by pre-splitting, as a fraction of the input triangle count
+    uint32_t lod_count = 0; // Simplified levels generated per mesh, each keeping lod_ratio of the previous one
+    float lod_ratio = 0.5f;
+};
+
+struct ConditioningReport {
+    size_t input_triangles = 0;
+    size_t degenerate_triangles = 0;
+    size_t split_triangles = 0;
+    float sah_before = 0.0f; // Only estimated when pre-splitting is enabled
+    float sah_after = 0.0f;
+};
+
+/**
+ * Removes zero-area triangles, then splits the triangles that waste the most bounding box area along their longest
+ * edge until the split budget is spent, together with their neighbours on that edge so the surface stays watertight.
+ * Skinned primitives are never split, their joints cannot be interpolated
+ * Source: Karras and Aila 2013, "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies"
+ * Web: https://research.nvidia.com/publication/2013-07_fast-parallel-construction-high-quality-bounding-volume-hierarchies
+ */
+ConditioningReport condition_mesh(Mesh& mesh, const ConditioningSettings& settings);
+
+// Surface area heuristic cost of a binned BVH over all triangles of the mesh, relative to its root bounds
+float estimate_sah_cost(const Mesh& mesh);
\ No newline at end of file
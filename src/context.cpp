@@ -10,10 +10,10 @@ std::vector device_extensions = {
     vk::KHRShaderClockExtensionName,
 };
 
-Context::Context(const bool validation)
+Context::Context(const bool validation, const bool host_builds)
     : instance(validation),
       adapter(instance, device_extensions),
-      device(adapter, device_extensions),
+      device(adapter, device_extensions, host_builds),
       allocator(instance, adapter, device),
       linear_sampler(device, vk::Filter::eLinear, vk::Filter::eLinear),
       nearest_sampler(device, vk::Filter::eNearest, vk::Filter::eNearest),
@@ -18,7 +18,7 @@ class Context {
     vk::raii::DescriptorSetLayout bindless_layout;
 
 public:
-    explicit Context(bool validation);
+    explicit Context(bool validation, bool host_builds);
 
     [[nodiscard]] const Instance& get_instance() const {
         return instance;
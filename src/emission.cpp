@@ -0,0 +1,81 @@
+#include "emission.h"
+
+#include <array>
+#include <cmath>
+
+constexpr int64_t MAX_EMISSION_SAMPLES = 1 << 16; // Larger footprints are averaged over a strided subset
+
+float srgb_to_linear(const uint8_t value) {
+    static const std::array<float, 256> table = [] {
+        std::array<float, 256> t{};
+        for (int i = 0; i < 256; ++i) {
+            const float c = static_cast<float>(i) / 255.0f;
+            t[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return t;
+    }();
+    return table[value];
+}
+
+// Repeat addressing, same as the texture sampler
+glm::vec3 read_texel(const TextureData& texture, const int64_t x, const int64_t y) {
+    const int64_t tx = (x % texture.width + texture.width) % texture.width;
+    const int64_t ty = (y % texture.height + texture.height) % texture.height;
+    const uint8_t* texel = texture.data + (ty * texture.width + tx) * 4;
+    return {srgb_to_linear(texel[0]), srgb_to_linear(texel[1]), srgb_to_linear(texel[2])};
+}
+
+glm::vec3 average_triangle_emission(const glm::vec2 (&uv)[3], const TextureData& emissive) {
+    if (!emissive.data || emissive.width <= 0 || emissive.height <= 0) return glm::vec3(1.0f);
+
+    // Texel centers at integer coordinates
+    const glm::vec2 size(emissive.width, emissive.height);
+    glm::vec2 p[3];
+    for (int i = 0; i < 3; ++i) {
+        p[i] = uv[i] * size - 0.5f;
+        if (!std::isfinite(p[i].x) || !std::isfinite(p[i].y)) return glm::vec3(1.0f);
+    }
+
+    const glm::vec2 centroid = (p[0] + p[1] + p[2]) / 3.0f;
+    const glm::vec3 centroid_texel = read_texel(emissive,
+                                                static_cast<int64_t>(std::round(centroid.x)),
+                                                static_cast<int64_t>(std::round(centroid.y)));
+
+    const glm::vec2 e01 = p[1] - p[0];
+    const glm::vec2 e02 = p[2] - p[0];
+    const float area = e01.x * e02.y - e01.y * e02.x;
+    if (std::abs(area) < 1e-8f) return centroid_texel;
+    const float orientation = area < 0.0f ? -1.0f : 1.0f;
+
+    const glm::vec2 lower = glm::ceil(glm::min(p[0], glm::min(p[1], p[2])));
+    const glm::vec2 upper = glm::floor(glm::max(p[0], glm::max(p[1], p[2])));
+    const auto x0 = static_cast<int64_t>(lower.x);
+    const auto y0 = static_cast<int64_t>(lower.y);
+    const auto x1 = static_cast<int64_t>(upper.x);
+    const auto y1 = static_cast<int64_t>(upper.y);
+    if (x1 < x0 || y1 < y0) return centroid_texel;
+
+    const int64_t footprint = (x1 - x0 + 1) * (y1 - y0 + 1);
+    const auto stride = static_cast<int64_t>(std::ceil(std::sqrt(static_cast<double>(footprint) / MAX_EMISSION_SAMPLES)));
+
+    glm::dvec3 sum(0.0);
+    int64_t count = 0;
+    for (int64_t y = y0; y <= y1; y += stride) {
+        for (int64_t x = x0; x <= x1; x += stride) {
+            const glm::vec2 c(x, y);
+            bool inside = true;
+            for (int i = 0; i < 3 && inside; ++i) {
+                const glm::vec2& a = p[i];
+                const glm::vec2 d = p[(i + 1) % 3] - a;
+                inside = orientation * (d.x * (c.y - a.y) - d.y * (c.x - a.x)) >= 0.0f;
+            }
+            if (!inside) continue;
+
+            sum += glm::dvec3(read_texel(emissive, x, y));
+            ++count;
+        }
+    }
+
+    if (count == 0) return centroid_texel;
+    return glm::vec3(sum / static_cast<double>(count));
+}
\ No newline at end of file
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "texture.h"
+
+/**
+ * Average linear color of an sRGB emissive texture over a triangle's UV footprint, the mean of the texels whose
+ * centers fall inside it. Triangles smaller than a texel read the texel under their UV centroid
+ */
+glm::vec3 average_triangle_emission(const glm::vec2 (&uv)[3], const TextureData& emissive);
\ No newline at end of file
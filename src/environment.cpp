@@ -0,0 +1,61 @@
+#include "environment.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <spdlog/spdlog.h>
+
+#include "alias_table.h"
+#include "jobs.h"
+#include "light_tree.h"
+#include "stb_image.h"
+#include "vulkan/utils.h"
+
+constexpr size_t ENVIRONMENT_MIN_BATCH = 16; // Rows
+
+EnvironmentData load_environment_data(const std::filesystem::path& path) {
+    SCOPED_TIMER();
+
+    EnvironmentData environment;
+
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    float* data = stbi_loadf(path.string().c_str(), &width, &height, &channels, 4);
+    if (!data) {
+        spdlog::error("Failed to load environment {}: {}", path.string(), stbi_failure_reason());
+        return environment;
+    }
+
+    environment.width = static_cast<uint32_t>(width);
+    environment.height = static_cast<uint32_t>(height);
+    const size_t pixel_count = static_cast<size_t>(environment.width) * environment.height;
+    environment.pixels.resize(pixel_count * 4);
+
+    std::vector<float> weights(pixel_count);
+    JobSystem::parallel_for(environment.height, ENVIRONMENT_MIN_BATCH, [&](const size_t begin, const size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+            const float theta = 3.14159265358979f * (static_cast<float>(y) + 0.5f) / static_cast<float>(environment.height);
+            const float sin_theta = std::sin(theta);
+            for (size_t x = 0; x < environment.width; ++x) {
+                const size_t pixel = y * environment.width + x;
+                const glm::vec4 color = glm::make_vec4(data + pixel * 4);
+                const glm::uvec2 packed(glm::packHalf2x16(glm::vec2(color.r, color.g)),
+                                        glm::packHalf2x16(glm::vec2(color.b, 1.0f)));
+                memcpy(environment.pixels.data() + pixel * 4, &packed, sizeof(packed));
+                weights[pixel] = std::max(luminance(glm::vec3(color)), 0.0f) * sin_theta;
+            }
+        }
+    });
+    stbi_image_free(data);
+
+    AliasTable alias_table;
+    alias_table.build(weights);
+    environment.alias_entries = alias_table.get_entries();
+
+    spdlog::info("Loaded environment {} ({}x{})", path.string(), width, height);
+    return environment;
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include "common.h"
+
+// Decoded equirectangular HDRI, +Y is up and the center column faces +X
+struct EnvironmentData {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint16_t> pixels; // RGBA16F, row-major from the top
+    std::vector<AliasEntry> alias_entries; // Pixels by luminance times solid angle
+};
+
+/**
+ * Loads a Radiance .hdr environment and builds the pixel alias table that importance samples it. Rows are weighted
+ * by sin(theta) so the table follows the solid angle of every pixel instead of its image area. Returns empty data
+ * on failure
+ * Source: Pharr, Jakob and Humphreys 2016, "Physically Based Rendering: From Theory to Implementation", 3rd edition
+ * Section 14.2.4
+ * Web: https://pbr-book.org/3ed-2018/Light_Transport_I_Surface_Reflection/Sampling_Light_Sources#InfiniteAreaLights
+ */
+EnvironmentData load_environment_data(const std::filesystem::path& path);
\ No newline at end of file
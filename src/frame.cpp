@@ -24,6 +24,7 @@ FrameManager::FrameManager(const Context& ctx, const int frames_in_flight, const
     constexpr auto uniform = Uniform{
         .inv_view = glm::mat4(1.0f),
         .inv_proj = glm::mat4(1.0f),
+        .prev_view_proj = glm::mat4(1.0f),
     };
     for (int i = 0; i < frames_in_flight; ++i) {
         auto buffer = BufferBuilder()
@@ -12,7 +12,8 @@ struct Uniform {
     // std140 base alignment 16 bytes
     glm::mat4 inv_view; // 0
     glm::mat4 inv_proj; // 64
-    // ============= 128
+    glm::mat4 prev_view_proj; // 128, reprojection of ReSTIR reservoirs
+    // ============= 192
 };
 
 class FrameManager {
@@ -0,0 +1,127 @@
+#include "jobs.h"
+
+#include <atomic>
+
+#include <spdlog/spdlog.h>
+
+void JobSystem::init(uint32_t thread_count) {
+    if (!workers.empty()) return;
+
+    if (thread_count == 0) {
+        thread_count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    }
+
+    stopping = false;
+    workers.reserve(thread_count);
+    for (uint32_t i = 0; i < thread_count; ++i) {
+        workers.emplace_back(worker_loop);
+    }
+
+    spdlog::info("JobSystem: started {} worker threads", thread_count);
+}
+
+void JobSystem::terminate() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void JobSystem::worker_loop() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock lock(mutex);
+            condition.wait(lock, [] { return stopping || !jobs.empty(); });
+            if (stopping && jobs.empty()) return;
+
+            job = std::move(jobs.front());
+            jobs.pop();
+        }
+        job();
+    }
+}
+
+void JobSystem::enqueue(std::function<void()> job) {
+    {
+        std::lock_guard lock(mutex);
+        jobs.push(std::move(job));
+    }
+    condition.notify_one();
+}
+
+std::future<void> JobSystem::submit(std::function<void()> job) {
+    auto task = std::make_shared<std::packaged_task<void()>>(std::move(job));
+    auto future = task->get_future();
+
+    if (workers.empty()) {
+        (*task)();
+        return future;
+    }
+
+    enqueue([task] { (*task)(); });
+    return future;
+}
+
+void JobSystem::parallel_for(const size_t count, const size_t min_batch,
+                             const std::function<void(size_t begin, size_t end)>& fn) {
+    if (count == 0) return;
+
+    // A few batches per thread keeps the load balanced when batches have uneven cost
+    const size_t target_batches = static_cast<size_t>(get_thread_count()) * 4;
+    const size_t batch_size = std::max(std::max<size_t>(min_batch, 1), (count + target_batches - 1) / target_batches);
+    const size_t batch_count = (count + batch_size - 1) / batch_size;
+
+    if (workers.empty() || batch_count == 1) {
+        fn(0, count);
+        return;
+    }
+
+    // Shared ownership, helpers may still be queued after the caller has returned
+    struct State {
+        std::function<void(size_t, size_t)> fn;
+        size_t count;
+        size_t batch_size;
+        size_t batch_count;
+        std::atomic<size_t> next_batch{0};
+        std::atomic<size_t> finished_batches{0};
+        std::mutex mutex;
+        std::condition_variable condition;
+    };
+
+    auto state = std::make_shared<State>();
+    state->fn = fn;
+    state->count = count;
+    state->batch_size = batch_size;
+    state->batch_count = batch_count;
+
+    auto run_batches = [state] {
+        for (size_t batch = state->next_batch.fetch_add(1); batch < state->batch_count;
+             batch = state->next_batch.fetch_add(1)) {
+            const size_t begin = batch * state->batch_size;
+            const size_t end = std::min(begin + state->batch_size, state->count);
+            state->fn(begin, end);
+
+            if (state->finished_batches.fetch_add(1) + 1 == state->batch_count) {
+                std::lock_guard lock(state->mutex);
+                state->condition.notify_all();
+            }
+        }
+    };
+
+    const size_t helper_count = std::min(workers.size(), batch_count - 1);
+    for (size_t i = 0; i < helper_count; ++i) {
+        enqueue(run_batches);
+    }
+
+    run_batches();
+
+    std::unique_lock lock(state->mutex);
+    state->condition.wait(lock, [&] { return state->finished_batches.load() == state->batch_count; });
+}
\ No newline at end of file
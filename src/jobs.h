@@ -0,0 +1,33 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class JobSystem {
+    inline static std::vector<std::thread> workers;
+    inline static std::queue<std::function<void()>> jobs;
+    inline static std::mutex mutex;
+    inline static std::condition_variable condition;
+    inline static bool stopping = false;
+
+    static void worker_loop();
+    static void enqueue(std::function<void()> job);
+
+public:
+    static void init(uint32_t thread_count = 0);
+    static void terminate();
+
+    static std::future<void> submit(std::function<void()> job);
+
+    // Splits [0, count) into batches of at least min_batch elements, the calling thread takes part in the work
+    static void parallel_for(size_t count, size_t min_batch, const std::function<void(size_t begin, size_t end)>& fn);
+
+    [[nodiscard]] static uint32_t get_thread_count() {
+        return static_cast<uint32_t>(workers.size()) + 1;
+    }
+};
@@ -0,0 +1,411 @@
+#include "light_tree.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include <glm/gtc/quaternion.hpp>
+
+constexpr float LIGHT_TREE_PI = 3.14159265358979f;
+
+// Above this depth the bit trail would overflow, so splits fall back to the object median
+constexpr uint32_t LIGHT_TREE_SAOH_MAX_DEPTH = 32;
+
+float safe_acos(const float x) {
+    return std::acos(std::clamp(x, -1.0f, 1.0f));
+}
+
+float luminance(const glm::vec3& color) {
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+LightBounds triangle_light_bounds(const Light& light) {
+    LightBounds bounds{};
+    bounds.min = glm::min(light.v0, glm::min(light.v1, light.v2));
+    bounds.max = glm::max(light.v0, glm::max(light.v1, light.v2));
+
+    // One-sided diffuse emitter, matches the cosine term of evaluate_light_pdf
+    bounds.phi = luminance(light.emission) * light.area * LIGHT_TREE_PI;
+
+    const glm::vec3 normal = glm::cross(light.v1 - light.v0, light.v2 - light.v0);
+    const float normal_length = glm::length(normal);
+    bounds.axis = normal_length > 0.0f ? normal / normal_length : glm::vec3(0.0f, 0.0f, 1.0f);
+    bounds.cos_theta_o = 1.0f;
+    bounds.cos_theta_e = 0.0f;
+    return bounds;
+}
+
+/**
+ * Point and spot lights bound their peak intensity over the whole sphere and let the cone do the falloff,
+ * rectangles and discs are one-sided diffuse emitters like the triangles
+ * Source: Pharr, Jakob and Humphreys 2023, "Physically Based Rendering: From Theory to Implementation", 4th edition
+ * Section 12.6.1
+ * Web: https://pbr-book.org/4ed/Light_Sources/Light_Sampling#LightBounds
+ */
+LightBounds analytic_light_bounds(const Light& light) {
+    LightBounds bounds{};
+    switch (light.type) {
+        case LightType::Point:
+        case LightType::Spot: {
+            bounds.min = light.v0;
+            bounds.max = light.v0;
+            bounds.phi = luminance(light.emission) * 4.0f * LIGHT_TREE_PI;
+            if (light.type == LightType::Spot) {
+                bounds.axis = light.v1;
+                bounds.cos_theta_o = light.v2.x;
+                bounds.cos_theta_e = std::cos(safe_acos(light.v2.y) - safe_acos(light.v2.x));
+            } else {
+                bounds.cos_theta_o = -1.0f;
+                bounds.cos_theta_e = 0.0f;
+            }
+            break;
+        }
+        case LightType::Rect: {
+            const glm::vec3 v3 = light.v0 + light.v1 + light.v2;
+            bounds.min = glm::min(glm::min(light.v0, v3), glm::min(light.v0 + light.v1, light.v0 + light.v2));
+            bounds.max = glm::max(glm::max(light.v0, v3), glm::max(light.v0 + light.v1, light.v0 + light.v2));
+            bounds.phi = luminance(light.emission) * light.area * LIGHT_TREE_PI;
+            bounds.axis = glm::normalize(glm::cross(light.v1, light.v2));
+            bounds.cos_theta_o = 1.0f;
+            bounds.cos_theta_e = 0.0f;
+            break;
+        }
+        case LightType::Disc: {
+            // Extent of a circle along every axis is its radius times the sine between the axis and the normal
+            const glm::vec3 extent = light.v2.x * glm::sqrt(glm::max(glm::vec3(0.0f), 1.0f - light.v1 * light.v1));
+            bounds.min = light.v0 - extent;
+            bounds.max = light.v0 + extent;
+            bounds.phi = luminance(light.emission) * light.area * LIGHT_TREE_PI;
+            bounds.axis = light.v1;
+            bounds.cos_theta_o = 1.0f;
+            bounds.cos_theta_e = 0.0f;
+            break;
+        }
+        case LightType::Triangle:
+            return triangle_light_bounds(light);
+    }
+    return bounds;
+}
+
+Light transform_light(const Light& light, const glm::mat4& transform) {
+    const glm::mat3 linear(transform);
+    Light out = light;
+    out.v0 = transform * glm::vec4(light.v0, 1.0f);
+
+    switch (light.type) {
+        case LightType::Spot:
+            out.v1 = glm::normalize(linear * light.v1);
+            break;
+        case LightType::Rect:
+            out.v1 = linear * light.v1;
+            out.v2 = linear * light.v2;
+            out.area = glm::length(glm::cross(out.v1, out.v2));
+            break;
+        case LightType::Disc: {
+            const glm::mat3 cofactor = glm::determinant(linear) * glm::transpose(glm::inverse(linear));
+            const glm::vec3 normal = cofactor * light.v1;
+            const float area_scale = glm::length(normal);
+            out.v1 = normal / area_scale;
+            out.v2.x = light.v2.x * std::sqrt(area_scale);
+            out.area = light.area * area_scale;
+            break;
+        }
+        case LightType::Triangle:
+            out.v1 = transform * glm::vec4(light.v1, 1.0f);
+            out.v2 = transform * glm::vec4(light.v2, 1.0f);
+            out.area = 0.5f * glm::length(glm::cross(out.v1 - out.v0, out.v2 - out.v0));
+            break;
+        case LightType::Point:
+            break;
+    }
+    return out;
+}
+
+LightBounds transform_light_bounds(const LightBounds& bounds, const glm::mat4& transform) {
+    LightBounds out = bounds;
+    out.min = glm::vec3(std::numeric_limits<float>::max());
+    out.max = glm::vec3(std::numeric_limits<float>::lowest());
+    for (uint32_t corner = 0; corner < 8; ++corner) {
+        const glm::vec3 p(corner & 1 ? bounds.max.x : bounds.min.x,
+                          corner & 2 ? bounds.max.y : bounds.min.y,
+                          corner & 4 ? bounds.max.z : bounds.min.z);
+        const glm::vec3 world = transform * glm::vec4(p, 1.0f);
+        out.min = glm::min(out.min, world);
+        out.max = glm::max(out.max, world);
+    }
+
+    // The cofactor matrix maps triangle normals and keeps their facing under mirroring
+    const glm::mat3 linear(transform);
+    const float det = glm::determinant(linear);
+    const glm::mat3 cofactor = det * glm::transpose(glm::inverse(linear));
+    const glm::vec3 axis = cofactor * bounds.axis;
+    const float axis_length = glm::length(axis);
+    out.axis = axis_length > 0.0f ? axis / axis_length : bounds.axis;
+
+    // Exact for similarity transforms, only the power of a non-uniformly scaled emitter is an estimate
+    const float scale_x = glm::length(linear[0]);
+    const float scale_y = glm::length(linear[1]);
+    const float scale_z = glm::length(linear[2]);
+    out.phi = bounds.phi * std::pow(std::abs(det), 2.0f / 3.0f);
+
+    // Normals that are not all parallel spread unevenly under non-uniform scale
+    const float max_scale = std::max(scale_x, std::max(scale_y, scale_z));
+    const float min_scale = std::min(scale_x, std::min(scale_y, scale_z));
+    if (bounds.cos_theta_o < 1.0f && max_scale - min_scale > 1e-4f * max_scale) {
+        out.cos_theta_o = -1.0f;
+    }
+    return out;
+}
+
+/**
+ * Union of two direction cones
+ * Source: Pharr, Jakob and Humphreys 2023, "Physically Based Rendering: From Theory to Implementation", 4th edition
+ * Section 3.8.4
+ * Web: https://pbr-book.org/4ed/Geometry_and_Transformations/Spherical_Geometry#BoundingDirections
+ */
+void union_cone(const glm::vec3& axis_a, const float cos_a,
+                const glm::vec3& axis_b, const float cos_b,
+                glm::vec3& axis, float& cos_theta) {
+    const float theta_a = safe_acos(cos_a);
+    const float theta_b = safe_acos(cos_b);
+    const float theta_d = safe_acos(glm::dot(axis_a, axis_b));
+
+    if (std::min(theta_d + theta_b, LIGHT_TREE_PI) <= theta_a) {
+        axis = axis_a;
+        cos_theta = cos_a;
+        return;
+    }
+    if (std::min(theta_d + theta_a, LIGHT_TREE_PI) <= theta_b) {
+        axis = axis_b;
+        cos_theta = cos_b;
+        return;
+    }
+
+    const float theta_o = (theta_a + theta_d + theta_b) * 0.5f;
+    const glm::vec3 rotation_axis = glm::cross(axis_a, axis_b);
+    if (theta_o >= LIGHT_TREE_PI || glm::dot(rotation_axis, rotation_axis) == 0.0f) {
+        axis = axis_a;
+        cos_theta = -1.0f;
+        return;
+    }
+
+    axis = glm::angleAxis(theta_o - theta_a, glm::normalize(rotation_axis)) * axis_a;
+    cos_theta = std::cos(theta_o);
+}
+
+LightBounds union_bounds(const LightBounds& a, const LightBounds& b) {
+    // Powerless bounds only grow the extent, their normals never receive samples
+    if (a.phi == 0.0f || b.phi == 0.0f) {
+        LightBounds out = a.phi == 0.0f ? b : a;
+        out.min = glm::min(a.min, b.min);
+        out.max = glm::max(a.max, b.max);
+        return out;
+    }
+
+    LightBounds out{};
+    out.min = glm::min(a.min, b.min);
+    out.max = glm::max(a.max, b.max);
+    out.phi = a.phi + b.phi;
+    union_cone(a.axis, a.cos_theta_o, b.axis, b.cos_theta_o, out.axis, out.cos_theta_o);
+    out.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+    return out;
+}
+
+/**
+ * Surface area orientation heuristic
+ * Source: Pharr, Jakob and Humphreys 2023, "Physically Based Rendering: From Theory to Implementation", 4th edition
+ * Section 12.6.3
+ * Web: https://pbr-book.org/4ed/Light_Sources/Light_Sampling#BVHLightSampling
+ */
+float evaluate_saoh_cost(const LightBounds& bounds, const glm::vec3& extent, const int dim) {
+    const float theta_o = safe_acos(bounds.cos_theta_o);
+    const float theta_e = safe_acos(bounds.cos_theta_e);
+    const float theta_w = std::min(theta_o + theta_e, LIGHT_TREE_PI);
+    const float sin_theta_o = std::sqrt(std::max(0.0f, 1.0f - bounds.cos_theta_o * bounds.cos_theta_o));
+
+    const float m_omega = 2.0f * LIGHT_TREE_PI * (1.0f - bounds.cos_theta_o) +
+                          LIGHT_TREE_PI / 2.0f * (2.0f * theta_w * sin_theta_o - std::cos(theta_o - 2.0f * theta_w) -
+                                                  2.0f * theta_o * sin_theta_o + bounds.cos_theta_o);
+
+    const glm::vec3 d = bounds.max - bounds.min;
+    const float surface_area = 2.0f * (d.x * d.y + d.x * d.z + d.y * d.z);
+    const float max_extent = std::max(extent.x, std::max(extent.y, extent.z));
+    const float kr = extent[dim] > 0.0f ? max_extent / extent[dim] : 1.0f;
+
+    return bounds.phi * m_omega * kr * surface_area;
+}
+
+void LightTree::build(const std::span<const LightBounds> light_bounds, const std::span<uint64_t> bit_trails) {
+    nodes.clear();
+    if (light_bounds.empty()) return;
+
+    // Emitters without power are left out, they keep a zero bit trail and the tree may end up empty
+    std::vector<BuildLight> build_lights;
+    build_lights.reserve(light_bounds.size());
+    for (uint32_t i = 0; i < light_bounds.size(); ++i) {
+        if (light_bounds[i].phi <= 0.0f) continue;
+        build_lights.push_back({
+            .light_index = i,
+            .bounds = light_bounds[i],
+            .centroid = (light_bounds[i].min + light_bounds[i].max) * 0.5f
+        });
+    }
+    std::ranges::fill(bit_trails, 0);
+    if (build_lights.empty()) return;
+
+    nodes.reserve(build_lights.size() * 2 - 1);
+    build_node(build_lights, bit_trails, 0, 0);
+}
+
+void LightTree::refit(const std::span<const LightBounds> light_bounds) {
+    // Children always follow their parent, so walking backwards visits them first
+    for (size_t i = nodes.size(); i-- > 0;) {
+        LightNode& node = nodes[i];
+
+        LightBounds bounds{};
+        if (node.is_leaf) {
+            bounds = light_bounds[node.second_child_or_light];
+        } else {
+            for (const uint32_t child : {static_cast<uint32_t>(i + 1), node.second_child_or_light}) {
+                const LightNode& child_node = nodes[child];
+                bounds = union_bounds(bounds, {
+                    .min = child_node.bounds_min,
+                    .max = child_node.bounds_max,
+                    .phi = child_node.phi,
+                    .axis = child_node.axis,
+                    .cos_theta_o = child_node.cos_theta_o,
+                    .cos_theta_e = child_node.cos_theta_e
+                });
+            }
+        }
+
+        node.bounds_min = bounds.min;
+        node.phi = bounds.phi;
+        node.bounds_max = bounds.max;
+        node.axis = bounds.axis;
+        node.cos_theta_o = bounds.cos_theta_o;
+        node.cos_theta_e = bounds.cos_theta_e;
+    }
+}
+
+uint32_t LightTree::build_node(const std::span<BuildLight> build_lights,
+                               const std::span<uint64_t> bit_trails,
+                               const uint64_t bit_trail,
+                               const uint32_t depth) {
+    const auto node_index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    if (build_lights.size() == 1) {
+        const auto& build_light = build_lights[0];
+        bit_trails[build_light.light_index] = bit_trail;
+
+        nodes[node_index] = {
+            .bounds_min = build_light.bounds.min,
+            .phi = build_light.bounds.phi,
+            .bounds_max = build_light.bounds.max,
+            .second_child_or_light = build_light.light_index,
+            .axis = build_light.bounds.axis,
+            .cos_theta_o = build_light.bounds.cos_theta_o,
+            .cos_theta_e = build_light.bounds.cos_theta_e,
+            .is_leaf = 1
+        };
+        return node_index;
+    }
+
+    LightBounds bounds{};
+    glm::vec3 centroid_min(std::numeric_limits<float>::max());
+    glm::vec3 centroid_max(std::numeric_limits<float>::lowest());
+    for (const auto& build_light : build_lights) {
+        bounds = union_bounds(bounds, build_light.bounds);
+        centroid_min = glm::min(centroid_min, build_light.centroid);
+        centroid_max = glm::max(centroid_max, build_light.centroid);
+    }
+
+    constexpr int bucket_count = 12;
+
+    float min_cost = std::numeric_limits<float>::max();
+    int min_cost_dim = -1;
+    int min_cost_bucket = -1;
+
+    const glm::vec3 extent = bounds.max - bounds.min;
+    const glm::vec3 centroid_extent = centroid_max - centroid_min;
+
+    if (depth < LIGHT_TREE_SAOH_MAX_DEPTH) {
+        for (int dim = 0; dim < 3; ++dim) {
+            if (centroid_extent[dim] <= 0.0f) continue;
+
+            std::array<LightBounds, bucket_count> buckets{};
+            std::array<uint32_t, bucket_count> bucket_sizes{};
+            for (const auto& build_light : build_lights) {
+                const float offset = (build_light.centroid[dim] - centroid_min[dim]) / centroid_extent[dim];
+                const int bucket = std::min(static_cast<int>(offset * bucket_count), bucket_count - 1);
+                buckets[bucket] = union_bounds(buckets[bucket], build_light.bounds);
+                bucket_sizes[bucket]++;
+            }
+
+            for (int split = 0; split < bucket_count - 1; ++split) {
+                LightBounds below{};
+                LightBounds above{};
+                uint32_t count_below = 0;
+                uint32_t count_above = 0;
+                for (int i = 0; i <= split; ++i) {
+                    below = union_bounds(below, buckets[i]);
+                    count_below += bucket_sizes[i];
+                }
+                for (int i = split + 1; i < bucket_count; ++i) {
+                    above = union_bounds(above, buckets[i]);
+                    count_above += bucket_sizes[i];
+                }
+                if (count_below == 0 || count_above == 0) continue;
+
+                const float cost = evaluate_saoh_cost(below, extent, dim) + evaluate_saoh_cost(above, extent, dim);
+                if (cost > 0.0f && cost < min_cost) {
+                    min_cost = cost;
+                    min_cost_dim = dim;
+                    min_cost_bucket = split;
+                }
+            }
+        }
+    }
+
+    auto middle = build_lights.begin() + build_lights.size() / 2;
+
+    if (min_cost_dim != -1) {
+        const int dim = min_cost_dim;
+        middle = std::partition(build_lights.begin(), build_lights.end(), [&](const BuildLight& build_light) {
+            const float offset = (build_light.centroid[dim] - centroid_min[dim]) / centroid_extent[dim];
+            const int bucket = std::min(static_cast<int>(offset * bucket_count), bucket_count - 1);
+            return bucket <= min_cost_bucket;
+        });
+    } else {
+        // No useful SAOH split, fall back to the object median along the widest centroid axis
+        int dim = 0;
+        if (centroid_extent.y > centroid_extent[dim]) dim = 1;
+        if (centroid_extent.z > centroid_extent[dim]) dim = 2;
+        std::nth_element(build_lights.begin(), middle, build_lights.end(), [dim](const BuildLight& a, const BuildLight& b) {
+            return a.centroid[dim] < b.centroid[dim];
+        });
+    }
+
+    if (middle == build_lights.begin() || middle == build_lights.end()) {
+        middle = build_lights.begin() + build_lights.size() / 2;
+    }
+
+    const size_t split_index = middle - build_lights.begin();
+
+    build_node(build_lights.subspan(0, split_index), bit_trails, bit_trail, depth + 1);
+    const uint32_t second_child = build_node(build_lights.subspan(split_index), bit_trails,
+                                             bit_trail | (uint64_t{1} << depth), depth + 1);
+
+    nodes[node_index] = {
+        .bounds_min = bounds.min,
+        .phi = bounds.phi,
+        .bounds_max = bounds.max,
+        .second_child_or_light = second_child,
+        .axis = bounds.axis,
+        .cos_theta_o = bounds.cos_theta_o,
+        .cos_theta_e = bounds.cos_theta_e,
+        .is_leaf = 0
+    };
+    return node_index;
+}
\ No newline at end of file
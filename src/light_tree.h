@@ -0,0 +1,53 @@
+#pragma once
+
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "common.h"
+
+float luminance(const glm::vec3& color);
+
+// Bounds, power and normal cone of a set of emitters
+struct LightBounds {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+    float phi = 0.0f;
+    glm::vec3 axis = glm::vec3(0.0f, 0.0f, 1.0f);
+    float cos_theta_o = 1.0f; // Spread of the normals around the axis
+    float cos_theta_e = 1.0f; // Emission falloff past the normal spread
+};
+
+LightBounds triangle_light_bounds(const Light& light);
+LightBounds analytic_light_bounds(const Light& light);
+// Analytic light after an affine transform, disc radii follow the area change of the disc
+Light transform_light(const Light& light, const glm::mat4& transform);
+// Bounds of the same emitters after an affine transform, the power is scaled by the transform's area change
+LightBounds transform_light_bounds(const LightBounds& bounds, const glm::mat4& transform);
+
+/**
+ * Light BVH over emitters, built with the surface area orientation heuristic
+ * Source: Conty Estevez and Kulla 2018, "Importance Sampling of Many Lights with Adaptive Tree Splitting"
+ * Web: https://fpsunflower.github.io/ckulla/data/many-lights-hpg2018.pdf
+ */
+class LightTree {
+    struct BuildLight {
+        uint32_t light_index; // Index into the emitters passed to build
+        LightBounds bounds;
+        glm::vec3 centroid;
+    };
+
+    std::vector<LightNode> nodes;
+
+    uint32_t build_node(std::span<BuildLight> build_lights, std::span<uint64_t> bit_trails, uint64_t bit_trail, uint32_t depth);
+
+public:
+    // Rebuilds the tree and writes the bit trail of every emitter, child indices are relative to the root
+    void build(std::span<const LightBounds> light_bounds, std::span<uint64_t> bit_trails);
+    // Recomputes the bounds of every node for moved emitters, the topology and the bit trails stay as built
+    void refit(std::span<const LightBounds> light_bounds);
+
+    [[nodiscard]] const std::vector<LightNode>& get_nodes() const {
+        return nodes;
+    }
+};
\ No newline at end of file
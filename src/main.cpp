@@ -8,6 +8,7 @@
 #include "gui.h"
 #include "imgui_internal.h"
 #include "input.h"
+#include "jobs.h"
 #include "renderer.h"
 #include "timer.h"
 #include "window.h"
@@ -89,6 +90,19 @@ void show_solid_sky_settings(Renderer& renderer) {
     }
 }
 
+void show_hdri_settings(Renderer& renderer) {
+    if (renderer.get_settings().environment_map.texture_index == UINT32_MAX) {
+        ImGui::Text("No HDRI loaded, pass one with --environment");
+        return;
+    }
+    float environment_emission = renderer.get_settings().environment_emission;
+    if (ImGui::DragFloat("HDRI Emission", &environment_emission, 0.01f, 0.0f, 1000.0f)) {
+        renderer.get_settings().environment_emission = environment_emission;
+        renderer.update_settings();
+        renderer.reset_frames();
+    }
+}
+
 void show_sun_settings(Renderer& renderer) {
     static glm::vec3 sun_color = renderer.get_settings().sun_color;
     static float sun_emission = renderer.get_settings().sun_emission;
@@ -148,10 +162,15 @@ int main(const int argc, char* argv[]) {
     spdlog::set_level(spdlog::level::info);
 
     bool validation = false;
+    bool host_builds = false;
 
     std::vector<std::string> args(argv, argv + argc);
 
     std::vector<std::string> arg_model_paths;
+    std::string arg_environment_path;
+    uint32_t arg_scatter_size = 0;
+    float arg_split_budget = 0.0f;
+    uint32_t arg_lod_count = 0;
 
     for (size_t i = 1; i < args.size(); ++i) {
         if (args[i] == "-h" || args[i] == "--help") {
@@ -159,11 +178,18 @@ int main(const int argc, char* argv[]) {
                 << "Options:\n"
                 << "  -h, --help          Display this help message and exit\n"
                 << "  -v, --validation    Enable Vulkan validation validation layers\n"
-                << "  -m, --model <FILE>  Load .glb model from the specified path\n";
+                << "  -m, --model <FILE>  Load .glb model from the specified path\n"
+                << "  -e, --environment <FILE>  Light the scene with a .hdr equirectangular environment\n"
+                << "  -s, --scatter <N>   Scatter the last model on an N x N x N grid generated on the GPU\n"
+                << "  -l, --lods <N>      Generate up to N simplified levels per rigid mesh, picked by distance\n"
+                << "  --split-budget <F>  Pre-split up to F times the triangle count of badly bounded triangles\n"
+                << "  --host-builds       Build BLASes on the CPU when a GPU supports it, always on for CPU devices\n";
             return 0;
         }
         if (args[i] == "-v" || args[i] == "--validation") {
             validation = true;
+        } else if (args[i] == "--host-builds") {
+            host_builds = true;
         } else if (args[i] == "-m" || args[i] == "--model") {
             if (i + 1 < args.size()) {
                 arg_model_paths.push_back(args[i + 1]);
@@ -173,6 +199,42 @@ int main(const int argc, char* argv[]) {
                     << "Try 'hwrt --help' for more information\n";
                 return 1;
             }
+        } else if (args[i] == "-e" || args[i] == "--environment") {
+            if (i + 1 < args.size()) {
+                arg_environment_path = args[i + 1];
+                i++;
+            } else {
+                std::cerr << "Error: " << args[i] << " requires a file path argument\n"
+                    << "Try 'hwrt --help' for more information\n";
+                return 1;
+            }
+        } else if (args[i] == "-s" || args[i] == "--scatter") {
+            if (i + 1 < args.size()) {
+                arg_scatter_size = static_cast<uint32_t>(std::stoul(args[i + 1]));
+                i++;
+            } else {
+                std::cerr << "Error: " << args[i] << " requires a grid size argument\n"
+                    << "Try 'hwrt --help' for more information\n";
+                return 1;
+            }
+        } else if (args[i] == "-l" || args[i] == "--lods") {
+            if (i + 1 < args.size()) {
+                arg_lod_count = static_cast<uint32_t>(std::stoul(args[i + 1]));
+                i++;
+            } else {
+                std::cerr << "Error: " << args[i] << " requires a level count argument\n"
+                    << "Try 'hwrt --help' for more information\n";
+                return 1;
+            }
+        } else if (args[i] == "--split-budget") {
+            if (i + 1 < args.size()) {
+                arg_split_budget = std::stof(args[i + 1]);
+                i++;
+            } else {
+                std::cerr << "Error: " << args[i] << " requires a fraction argument\n"
+                    << "Try 'hwrt --help' for more information\n";
+                return 1;
+            }
         } else {
             std::cerr << "Error: unknown option '" << args[i] << "'\n"
                 << "Try 'hwrt --help' for more information.\n";
@@ -182,6 +244,7 @@ int main(const int argc, char* argv[]) {
 
     Window::init(WIDTH, HEIGHT, "hwrt");
     Window::hide();
+    JobSystem::init();
     {
         float speed = 3.0f;
         float delta = 0.0f;
@@ -189,9 +252,10 @@ int main(const int argc, char* argv[]) {
         bool show_gui = false;
 
         Timer timer{};
-        Context ctx(validation);
+        Context ctx(validation, host_builds);
 
         AssetManager asset_manager;
+        asset_manager.set_conditioning({.split_budget = arg_split_budget, .lod_count = arg_lod_count});
 
         //const auto model = asset_manager.get_model("../assets/models/sponza.glb");
 
@@ -201,6 +265,9 @@ int main(const int argc, char* argv[]) {
 
         Scene scene;
         scene.set_camera(camera);
+        if (!arg_environment_path.empty()) {
+            scene.load_environment(arg_environment_path);
+        }
         //scene.add_instance(model, glm::mat4(1.0f), ctx);
 
         //glm::scale(glm::mat4(1.0f), glm::vec3(0.01f)
@@ -209,6 +276,10 @@ int main(const int argc, char* argv[]) {
             scene.add_instance(asset_manager.get_model(path), glm::mat4(1.0f), ctx);
         }
 
+        if (arg_scatter_size > 0 && !arg_model_paths.empty()) {
+            scene.add_scatter(asset_manager.get_model(arg_model_paths.back()), ScatterGrid{.size = arg_scatter_size}, ctx);
+        }
+
         std::default_random_engine generator;
         std::uniform_real_distribution distribution(0.0f, 360.0f);
 
@@ -235,11 +306,17 @@ int main(const int argc, char* argv[]) {
         scene.build_blases(ctx);
         scene.build_tlas(ctx);
         scene.build_light_buffer(ctx);
+        scene.build_environment(ctx);
         scene.build_descriptor_set(ctx);
 
         //spdlog::info("Loaded scene with {} instances", pow(size, 3));
 
         Renderer renderer(ctx);
+        if (scene.get_environment_map().texture_index != UINT32_MAX) {
+            renderer.get_settings().environment_type = EnvironmentType::Hdri;
+            renderer.get_settings().environment_map = scene.get_environment_map();
+            renderer.update_settings();
+        }
 
         Gui::init(ctx, renderer.get_swapchain());
 
@@ -385,7 +462,8 @@ int main(const int argc, char* argv[]) {
                     "Uniform Sampling",
                     "Importance Sampling",
                     "Next Event Estimation",
-                    "Multiple Importance Sampling"
+                    "Multiple Importance Sampling",
+                    "ReSTIR GI"
                 };
                 static int sampling_strategy_idx = static_cast<int>(renderer.get_settings().sampling_strategy);
                 if (ImGui::Combo("Sampling Strategy", &sampling_strategy_idx, sampling_strategy_items,
@@ -394,6 +472,87 @@ int main(const int argc, char* argv[]) {
                     renderer.update_settings();
                     renderer.reset_frames();
                 }
+                static bool russian_roulette = renderer.get_settings().russian_roulette == RussianRoulette::Enabled;
+                if (ImGui::Checkbox("Russian Roulette", &russian_roulette)) {
+                    renderer.get_settings().russian_roulette = static_cast<RussianRoulette>(russian_roulette);
+                    renderer.update_settings();
+                    renderer.reset_frames();
+                }
+                static bool path_regeneration = renderer.get_settings().path_regeneration == PathRegeneration::Enabled;
+                if (ImGui::Checkbox("Path Regeneration", &path_regeneration)) {
+                    renderer.get_settings().path_regeneration = static_cast<PathRegeneration>(path_regeneration);
+                    renderer.update_settings();
+                    renderer.reset_frames();
+                }
+                const char* light_sampling_items[] = {
+                    "Uniform",
+                    "Light Tree",
+                    "Power"
+                };
+                static int light_sampling_idx = static_cast<int>(renderer.get_settings().light_sampling);
+                if (ImGui::Combo("Light Sampling", &light_sampling_idx, light_sampling_items,
+                                 IM_ARRAYSIZE(light_sampling_items))) {
+                    renderer.get_settings().light_sampling = static_cast<LightSampling>(light_sampling_idx);
+                    renderer.update_settings();
+                    renderer.reset_frames();
+                }
+                const char* triangle_sampling_items[] = {
+                    "Area",
+                    "Solid Angle"
+                };
+                static int triangle_sampling_idx = static_cast<int>(renderer.get_settings().triangle_sampling);
+                if (ImGui::Combo("Triangle Sampling", &triangle_sampling_idx, triangle_sampling_items,
+                                 IM_ARRAYSIZE(triangle_sampling_items))) {
+                    renderer.get_settings().triangle_sampling = static_cast<TriangleSampling>(triangle_sampling_idx);
+                    renderer.update_settings();
+                    renderer.reset_frames();
+                }
+                static bool restir_di = renderer.get_settings().restir_di == RestirDi::Enabled;
+                if (ImGui::Checkbox("ReSTIR DI", &restir_di)) {
+                    renderer.get_settings().restir_di = static_cast<RestirDi>(restir_di);
+                    renderer.update_settings();
+                    renderer.reset_frames();
+                }
+                if (restir_di) {
+                    int restir_candidates = static_cast<int>(renderer.get_settings().restir_candidates);
+                    if (ImGui::SliderInt("ReSTIR Candidates", &restir_candidates, 1, 64)) {
+                        renderer.get_settings().restir_candidates = std::clamp(restir_candidates, 1, 64);
+                        renderer.update_settings();
+                        renderer.reset_frames();
+                    }
+                }
+                static bool path_guiding = renderer.get_settings().path_guiding == PathGuiding::Enabled;
+                if (ImGui::Checkbox("Path Guiding", &path_guiding)) {
+                    renderer.get_settings().path_guiding = static_cast<PathGuiding>(path_guiding);
+                    renderer.update_settings();
+                    renderer.reset_frames();
+                }
+                if (path_guiding) {
+                    float guiding_cell_size = renderer.get_settings().guiding_cell_size;
+                    if (ImGui::DragFloat("Guiding Cell Size", &guiding_cell_size, 0.01f, 0.05f, 10.0f)) {
+                        renderer.get_settings().guiding_cell_size = std::clamp(guiding_cell_size, 0.05f, 10.0f);
+                        renderer.update_settings();
+                        renderer.reset_frames();
+                    }
+                    float guiding_probability = renderer.get_settings().guiding_probability;
+                    if (ImGui::SliderFloat("Guiding Probability", &guiding_probability, 0.0f, 0.9f)) {
+                        renderer.get_settings().guiding_probability = guiding_probability;
+                        renderer.update_settings();
+                        renderer.reset_frames();
+                    }
+                }
+                const char* sample_sequence_items[] = {
+                    "Random",
+                    "Sobol",
+                    "Blue Noise Sobol"
+                };
+                static int sample_sequence_idx = static_cast<int>(renderer.get_settings().sample_sequence);
+                if (ImGui::Combo("Sample Sequence", &sample_sequence_idx, sample_sequence_items,
+                                 IM_ARRAYSIZE(sample_sequence_items))) {
+                    renderer.get_settings().sample_sequence = static_cast<SampleSequence>(sample_sequence_idx);
+                    renderer.update_settings();
+                    renderer.reset_frames();
+                }
                 const char* environment_type_items[] = {
                     "None",
                     "Solid",
@@ -411,7 +570,8 @@ int main(const int argc, char* argv[]) {
                     case EnvironmentType::None: break;
                     case EnvironmentType::Solid: show_solid_sky_settings(renderer);
                         break;
-                    case EnvironmentType::Hdri: break;
+                    case EnvironmentType::Hdri: show_hdri_settings(renderer);
+                        break;
                     case EnvironmentType::Procedural: break;
                 }
                 static bool enable_sun = true;
@@ -435,6 +595,21 @@ int main(const int argc, char* argv[]) {
                     renderer.update_settings();
                     renderer.reset_frames();
                 }
+                if (scene.has_animations()) {
+                    static bool play_animation = true;
+                    if (ImGui::Checkbox("Play Animation", &play_animation)) {
+                        scene.set_animation_playing(play_animation);
+                        renderer.reset_frames();
+                    }
+                    float animation_speed = scene.get_animation_speed();
+                    if (ImGui::DragFloat("Animation Speed", &animation_speed, 0.01f, 0.0f, 10.0f)) {
+                        scene.set_animation_speed(animation_speed);
+                    }
+                    int motion_history = static_cast<int>(renderer.motion_history);
+                    if (ImGui::SliderInt("Motion History", &motion_history, 1, 32)) {
+                        renderer.motion_history = static_cast<uint32_t>(motion_history);
+                    }
+                }
                 if (ImGui::Button("Reload Shaders (R)")) {
                     renderer.reload_shaders();
                 }
@@ -445,6 +620,7 @@ int main(const int argc, char* argv[]) {
             Gui::end();
 
             scene.set_camera(camera);
+            scene.update(delta);
             renderer.draw_frame(scene);
 
             static float log_accumulator = 0.0f;
@@ -464,6 +640,7 @@ int main(const int argc, char* argv[]) {
         ctx.get_device().get().waitIdle();
         Gui::terminate();
     }
+    JobSystem::terminate();
     Window::terminate();
 
     return 0;
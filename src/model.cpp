@@ -1,10 +1,17 @@
 #include "model.h"
 
+#include <cmath>
+#include <numeric>
+
 #include <fastgltf/tools.hpp>
 #include <fastgltf/glm_element_traits.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtx/matrix_decompose.hpp>
 #include <spdlog/spdlog.h>
 
+#include "jobs.h"
+#include "light_tree.h"
+#include "simplify.h"
 #include "vulkan/buffer.h"
 
 #include "stb_image.h"
@@ -12,6 +19,92 @@
 
 #include "texture.h"
 
+constexpr float DEFAULT_POINT_RADIUS = 0.01f;
+constexpr float DEFAULT_CURVE_RADIUS = 0.001f;
+constexpr float DEFAULT_SPOT_OUTER_CONE = 0.785398f; // pi / 4, as in KHR_lights_punctual
+
+// KHR_lights_punctual light at the origin of its node, spots point down -Z
+Light get_punctual_light(const fastgltf::Light& gltf_light) {
+    const glm::vec3 color(gltf_light.color[0], gltf_light.color[1], gltf_light.color[2]);
+
+    Light light{
+        .emission = color * static_cast<float>(gltf_light.intensity),
+        .v0 = glm::vec3(0.0f),
+        .v1 = glm::vec3(0.0f, 0.0f, -1.0f),
+        .v2 = glm::vec3(0.0f),
+        .area = 0.0f,
+        .type = LightType::Point
+    };
+
+    if (gltf_light.type == fastgltf::LightType::Spot) {
+        const float inner = gltf_light.innerConeAngle.has_value() ? gltf_light.innerConeAngle.value() : 0.0f;
+        const float outer = gltf_light.outerConeAngle.has_value() ? gltf_light.outerConeAngle.value() : DEFAULT_SPOT_OUTER_CONE;
+        light.type = LightType::Spot;
+        light.v2 = glm::vec3(std::cos(inner), std::cos(outer), 0.0f);
+    }
+    return light;
+}
+
+// Point and line primitives become analytic shapes sized by the application specific _RADIUS attribute, their
+// vertices are only kept as positions of the shapes
+void build_procedurals(Primitive& primitive,
+                       const fastgltf::PrimitiveType type,
+                       const std::vector<float>& radii,
+                       const bool have_normals) {
+    const bool points = type == fastgltf::PrimitiveType::Points;
+    const float default_radius = points ? DEFAULT_POINT_RADIUS : DEFAULT_CURVE_RADIUS;
+    const auto radius = [&](const uint32_t index) {
+        return radii.empty() ? default_radius : radii[index];
+    };
+
+    auto& indices = primitive.indices;
+    if (indices.empty()) {
+        indices.resize(primitive.vertices.size());
+        std::iota(indices.begin(), indices.end(), 0u);
+    }
+
+    const auto add_segment = [&](const uint32_t i0, const uint32_t i1) {
+        primitive.procedurals.push_back({
+            .p0 = primitive.vertices[i0].position,
+            .r0 = radius(i0),
+            .p1 = primitive.vertices[i1].position,
+            .r1 = radius(i1)
+        });
+    };
+
+    if (points) {
+        primitive.shape = have_normals ? PrimitiveShape::Discs : PrimitiveShape::Spheres;
+        for (const uint32_t index : indices) {
+            primitive.procedurals.push_back({
+                .p0 = primitive.vertices[index].position,
+                .r0 = radius(index),
+                .p1 = have_normals ? glm::normalize(primitive.vertices[index].normal) : glm::vec3(0.0f),
+            });
+        }
+    } else {
+        primitive.shape = PrimitiveShape::Curves;
+        if (type == fastgltf::PrimitiveType::Lines) {
+            for (size_t i = 0; i + 1 < indices.size(); i += 2) {
+                add_segment(indices[i], indices[i + 1]);
+            }
+        } else {
+            for (size_t i = 0; i + 1 < indices.size(); ++i) {
+                add_segment(indices[i], indices[i + 1]);
+            }
+            if (type == fastgltf::PrimitiveType::LineLoop && indices.size() > 2) {
+                add_segment(indices.back(), indices.front());
+            }
+        }
+    }
+
+    // Analytic shapes are never deformed, simplified or split into triangles
+    primitive.vertices.clear();
+    primitive.indices.clear();
+    primitive.skin.clear();
+    primitive.morph_deltas.clear();
+    primitive.morph_target_count = 0;
+}
+
 void Model::process_mesh(const fastgltf::Asset& asset, const fastgltf::Mesh& gltf_mesh) {
     Mesh mesh{};
 
@@ -29,7 +122,9 @@ void Model::process_mesh(const fastgltf::Asset& asset, const fastgltf::Mesh& glt
             primitive.vertices[idx].position = pos;
         });
 
-        if (const auto* norm_iter = gltf_primitive.findAttribute("NORMAL"); norm_iter != gltf_primitive.attributes.end()) {
+        const auto* norm_iter = gltf_primitive.findAttribute("NORMAL");
+        const bool have_normals = norm_iter != gltf_primitive.attributes.end();
+        if (have_normals) {
             const auto& norm_accessor = asset.accessors[norm_iter->accessorIndex];
             fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, norm_accessor, [&](const glm::vec3 norm, const size_t idx) {
                 primitive.vertices[idx].normal = norm;
@@ -53,6 +148,39 @@ void Model::process_mesh(const fastgltf::Asset& asset, const fastgltf::Mesh& glt
             });
         }
 
+        const auto* joints_iter = gltf_primitive.findAttribute("JOINTS_0");
+        const auto* weights_iter = gltf_primitive.findAttribute("WEIGHTS_0");
+        if (joints_iter != gltf_primitive.attributes.end() && weights_iter != gltf_primitive.attributes.end()) {
+            primitive.skin.resize(primitive.vertices.size());
+            fastgltf::iterateAccessorWithIndex<glm::uvec4>(asset, asset.accessors[joints_iter->accessorIndex], [&](const glm::uvec4 joints, const size_t idx) {
+                primitive.skin[idx].joints = joints;
+            });
+            fastgltf::iterateAccessorWithIndex<glm::vec4>(asset, asset.accessors[weights_iter->accessorIndex], [&](const glm::vec4 weights, const size_t idx) {
+                primitive.skin[idx].weights = weights;
+            });
+        }
+
+        primitive.morph_target_count = static_cast<uint32_t>(gltf_primitive.targets.size());
+        if (primitive.morph_target_count > 0) {
+            const size_t vertex_count = primitive.vertices.size();
+            primitive.morph_deltas.resize(primitive.morph_target_count * vertex_count);
+
+            for (size_t target = 0; target < gltf_primitive.targets.size(); ++target) {
+                MorphDelta* deltas = primitive.morph_deltas.data() + target * vertex_count;
+
+                if (const auto* iter = gltf_primitive.findTargetAttribute(target, "POSITION"); iter != gltf_primitive.targets[target].end()) {
+                    fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, asset.accessors[iter->accessorIndex], [&](const glm::vec3 delta, const size_t idx) {
+                        deltas[idx].position = delta;
+                    });
+                }
+                if (const auto* iter = gltf_primitive.findTargetAttribute(target, "NORMAL"); iter != gltf_primitive.targets[target].end()) {
+                    fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, asset.accessors[iter->accessorIndex], [&](const glm::vec3 delta, const size_t idx) {
+                        deltas[idx].normal = delta;
+                    });
+                }
+            }
+        }
+
         if (gltf_primitive.indicesAccessor.has_value()) {
             const auto& accessor = asset.accessors[gltf_primitive.indicesAccessor.value()];
             primitive.indices.reserve(accessor.count);
@@ -65,13 +193,34 @@ void Model::process_mesh(const fastgltf::Asset& asset, const fastgltf::Mesh& glt
             primitive.material_index = gltf_primitive.materialIndex.value();
         }
 
-        if (!have_tangents) {
+        const auto type = gltf_primitive.type;
+        if (type == fastgltf::PrimitiveType::Points ||
+            type == fastgltf::PrimitiveType::Lines ||
+            type == fastgltf::PrimitiveType::LineLoop ||
+            type == fastgltf::PrimitiveType::LineStrip) {
+            std::vector<float> radii;
+            if (const auto* radius_iter = gltf_primitive.findAttribute("_RADIUS"); radius_iter != gltf_primitive.attributes.end()) {
+                radii.resize(primitive.vertices.size());
+                fastgltf::iterateAccessorWithIndex<float>(asset, asset.accessors[radius_iter->accessorIndex], [&](const float radius, const size_t idx) {
+                    radii[idx] = radius;
+                });
+            }
+            build_procedurals(primitive, type, radii, have_normals);
+        } else if (!have_tangents) {
             TangentGenerator::generate(&primitive);
         }
 
         mesh.primitives.push_back(primitive);
     }
 
+    // Targets without explicit default weights start at zero
+    uint32_t morph_target_count = 0;
+    for (const auto& primitive : mesh.primitives) {
+        morph_target_count = std::max(morph_target_count, primitive.morph_target_count);
+    }
+    mesh.weights.assign(gltf_mesh.weights.begin(), gltf_mesh.weights.end());
+    mesh.weights.resize(morph_target_count, 0.0f);
+
     meshes.emplace_back(mesh);
 }
 
@@ -101,9 +250,24 @@ void Model::process_node(const fastgltf::Asset& asset, const size_t node_index,
     const glm::mat4 global_transform = parent_transform * local_transform;
 
     if (gltf_node.meshIndex.has_value()) {
-        nodes.emplace_back(gltf_node.meshIndex.value(), global_transform);
+        const uint32_t skin_index = gltf_node.skinIndex.has_value()
+                                        ? static_cast<uint32_t>(gltf_node.skinIndex.value())
+                                        : UINT32_MAX;
+        nodes.emplace_back(gltf_node.meshIndex.value(), global_transform, node_index, skin_index);
     }
 
+    // Lights keep the transform of the default pose, directional ones have no position to sample
+    if (gltf_node.lightIndex.has_value()) {
+        const auto& gltf_light = asset.lights[gltf_node.lightIndex.value()];
+        if (gltf_light.type == fastgltf::LightType::Directional) {
+            spdlog::warn("Skipping directional light \"{}\", use the sun instead", gltf_light.name);
+        } else {
+            lights.push_back(transform_light(get_punctual_light(gltf_light), global_transform));
+        }
+    }
+
+    hierarchy_order.push_back(static_cast<uint32_t>(node_index));
+
     for (const size_t child_index : gltf_node.children) {
         process_node(asset, child_index, global_transform);
     }
@@ -221,7 +385,195 @@ void Model::process_material(const fastgltf::Asset& asset, const fastgltf::Mater
     materials.emplace_back(material);
 }
 
-Model::Model(const fastgltf::Asset& asset) {
+void Model::process_hierarchy(const fastgltf::Asset& asset) {
+    hierarchy.resize(asset.nodes.size());
+
+    for (size_t i = 0; i < asset.nodes.size(); ++i) {
+        const auto& gltf_node = asset.nodes[i];
+        auto& node = hierarchy[i];
+
+        if (const auto* trs = std::get_if<fastgltf::TRS>(&gltf_node.transform)) {
+            node.translation = glm::make_vec3(trs->translation.data());
+            node.rotation = glm::make_quat(trs->rotation.data());
+            node.scale = glm::make_vec3(trs->scale.data());
+        } else {
+            glm::vec3 skew;
+            glm::vec4 perspective;
+            glm::decompose(get_transform_matrix(gltf_node), node.scale, node.rotation, node.translation, skew, perspective);
+        }
+
+        if (gltf_node.meshIndex.has_value()) {
+            const auto& mesh_weights = meshes[gltf_node.meshIndex.value()].weights;
+            if (gltf_node.weights.empty()) {
+                node.weights = mesh_weights;
+            } else {
+                node.weights.assign(gltf_node.weights.begin(), gltf_node.weights.end());
+                node.weights.resize(mesh_weights.size(), 0.0f);
+            }
+        }
+
+        for (const size_t child_index : gltf_node.children) {
+            hierarchy[child_index].parent = static_cast<uint32_t>(i);
+        }
+    }
+}
+
+void Model::process_skin(const fastgltf::Asset& asset, const fastgltf::Skin& gltf_skin) {
+    Skin skin{};
+
+    skin.joints.reserve(gltf_skin.joints.size());
+    for (const size_t joint : gltf_skin.joints) {
+        skin.joints.push_back(static_cast<uint32_t>(joint));
+    }
+
+    skin.inverse_bind_matrices.resize(skin.joints.size(), glm::mat4(1.0f));
+    if (gltf_skin.inverseBindMatrices.has_value()) {
+        const auto& accessor = asset.accessors[gltf_skin.inverseBindMatrices.value()];
+        fastgltf::iterateAccessorWithIndex<glm::mat4>(asset, accessor, [&](const glm::mat4& matrix, const size_t idx) {
+            if (idx < skin.inverse_bind_matrices.size()) {
+                skin.inverse_bind_matrices[idx] = matrix;
+            }
+        });
+    }
+
+    skins.emplace_back(std::move(skin));
+}
+
+void Model::process_animation(const fastgltf::Asset& asset, const fastgltf::Animation& gltf_animation) {
+    Animation animation{};
+    animation.name = gltf_animation.name;
+
+    animation.samplers.reserve(gltf_animation.samplers.size());
+    for (const auto& gltf_sampler : gltf_animation.samplers) {
+        AnimationSampler sampler{};
+
+        switch (gltf_sampler.interpolation) {
+            case fastgltf::AnimationInterpolation::Step: sampler.interpolation = AnimationInterpolation::Step;
+                break;
+            case fastgltf::AnimationInterpolation::CubicSpline: sampler.interpolation = AnimationInterpolation::CubicSpline;
+                break;
+            default: sampler.interpolation = AnimationInterpolation::Linear;
+                break;
+        }
+
+        const auto& input_accessor = asset.accessors[gltf_sampler.inputAccessor];
+        sampler.times.resize(input_accessor.count);
+        fastgltf::iterateAccessorWithIndex<float>(asset, input_accessor, [&](const float time, const size_t idx) {
+            sampler.times[idx] = time;
+        });
+
+        const auto& output_accessor = asset.accessors[gltf_sampler.outputAccessor];
+        switch (output_accessor.type) {
+            case fastgltf::AccessorType::Vec3:
+                sampler.stride = 3;
+                sampler.values.resize(output_accessor.count * 3);
+                fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, output_accessor, [&](const glm::vec3 v, const size_t idx) {
+                    std::copy_n(glm::value_ptr(v), 3, sampler.values.data() + idx * 3);
+                });
+                break;
+            case fastgltf::AccessorType::Vec4:
+                sampler.stride = 4;
+                sampler.values.resize(output_accessor.count * 4);
+                fastgltf::iterateAccessorWithIndex<glm::vec4>(asset, output_accessor, [&](const glm::vec4 v, const size_t idx) {
+                    std::copy_n(glm::value_ptr(v), 4, sampler.values.data() + idx * 4);
+                });
+                break;
+            case fastgltf::AccessorType::Scalar: {
+                // Morph target weights, one scalar per target and key
+                sampler.values.resize(output_accessor.count);
+                fastgltf::iterateAccessorWithIndex<float>(asset, output_accessor, [&](const float v, const size_t idx) {
+                    sampler.values[idx] = v;
+                });
+                const size_t values_per_key = sampler.interpolation == AnimationInterpolation::CubicSpline ? 3 : 1;
+                const size_t key_count = sampler.times.size() * values_per_key;
+                sampler.stride = key_count > 0 ? static_cast<uint32_t>(output_accessor.count / key_count) : 0;
+                break;
+            }
+            default:
+                spdlog::warn("Animation {}: unsupported sampler output type", gltf_animation.name);
+                sampler.stride = 0;
+                break;
+        }
+
+        if (!sampler.times.empty()) {
+            animation.duration = std::max(animation.duration, sampler.times.back());
+        }
+
+        animation.samplers.push_back(std::move(sampler));
+    }
+
+    animation.channels.reserve(gltf_animation.channels.size());
+    for (const auto& gltf_channel : gltf_animation.channels) {
+        if (!gltf_channel.nodeIndex.has_value()) continue;
+
+        AnimationPath path;
+        switch (gltf_channel.path) {
+            case fastgltf::AnimationPath::Translation: path = AnimationPath::Translation;
+                break;
+            case fastgltf::AnimationPath::Rotation: path = AnimationPath::Rotation;
+                break;
+            case fastgltf::AnimationPath::Scale: path = AnimationPath::Scale;
+                break;
+            case fastgltf::AnimationPath::Weights: path = AnimationPath::Weights;
+                break;
+            default: continue;
+        }
+
+        animation.channels.push_back({
+            .sampler = static_cast<uint32_t>(gltf_channel.samplerIndex),
+            .node = static_cast<uint32_t>(gltf_channel.nodeIndex.value()),
+            .path = path
+        });
+    }
+
+    animations.emplace_back(std::move(animation));
+}
+
+void Model::sample_pose(const uint32_t animation_index, const float time, Pose& pose) const {
+    std::vector<HierarchyNode> local_nodes = hierarchy;
+
+    const auto& animation = animations[animation_index];
+    for (const auto& channel : animation.channels) {
+        const auto& sampler = animation.samplers[channel.sampler];
+        auto& node = local_nodes[channel.node];
+
+        float value[4];
+        switch (channel.path) {
+            case AnimationPath::Translation:
+                if (sampler.stride != 3) break;
+                sampler.sample(time, channel.path, value);
+                node.translation = glm::make_vec3(value);
+                break;
+            case AnimationPath::Rotation:
+                if (sampler.stride != 4) break;
+                sampler.sample(time, channel.path, value);
+                node.rotation = glm::quat(value[3], value[0], value[1], value[2]);
+                break;
+            case AnimationPath::Scale:
+                if (sampler.stride != 3) break;
+                sampler.sample(time, channel.path, value);
+                node.scale = glm::make_vec3(value);
+                break;
+            case AnimationPath::Weights:
+                if (sampler.stride == 0 || sampler.stride != node.weights.size()) break;
+                sampler.sample(time, channel.path, node.weights.data());
+                break;
+        }
+    }
+
+    pose.node_transforms.resize(hierarchy.size());
+    pose.node_weights.resize(hierarchy.size());
+    for (const uint32_t node_index : hierarchy_order) {
+        const auto& node = local_nodes[node_index];
+        const glm::mat4 local_transform = node.local_transform();
+        pose.node_weights[node_index] = node.weights;
+        pose.node_transforms[node_index] = node.parent == UINT32_MAX
+                                               ? local_transform
+                                               : pose.node_transforms[node.parent] * local_transform;
+    }
+}
+
+Model::Model(const fastgltf::Asset& asset, const ConditioningSettings& conditioning) {
     meshes.reserve(asset.meshes.size());
     size_t prim_count = 0;
     for (const auto& gltf_mesh : asset.meshes) {
@@ -229,12 +581,51 @@ Model::Model(const fastgltf::Asset& asset) {
         prim_count += gltf_mesh.primitives.size();
     }
 
+    // Meshes are conditioned independently before any BLAS sees them
+    std::vector<ConditioningReport> reports(meshes.size());
+    JobSystem::parallel_for(meshes.size(), 1, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            reports[i] = condition_mesh(meshes[i], conditioning);
+            build_mesh_lods(meshes[i], conditioning.lod_count, conditioning.lod_ratio);
+        }
+    });
+
+    ConditioningReport total;
+    for (const auto& report : reports) {
+        total.input_triangles += report.input_triangles;
+        total.degenerate_triangles += report.degenerate_triangles;
+        total.split_triangles += report.split_triangles;
+        total.sah_before += report.sah_before;
+        total.sah_after += report.sah_after;
+    }
+
+    spdlog::info("Geometry conditioning: {} triangles, {} degenerate removed, {} added by pre-splitting",
+                 total.input_triangles,
+                 total.degenerate_triangles,
+                 total.split_triangles);
+    if (conditioning.split_budget > 0.0f) {
+        spdlog::info("Estimated SAH cost summed over meshes: {:.1f} before, {:.1f} after pre-splitting",
+                     total.sah_before,
+                     total.sah_after);
+    }
+    if (conditioning.lod_count > 0) {
+        size_t lod_meshes = 0;
+        size_t lod_levels = 0;
+        for (const auto& mesh : meshes) {
+            lod_meshes += mesh.lod_errors.empty() ? 0 : 1;
+            lod_levels += mesh.lod_errors.size();
+        }
+        spdlog::info("Mesh LODs: {} levels over {} of {} meshes", lod_levels, lod_meshes, meshes.size());
+    }
+
     size_t scene_index = 0;
     if (asset.defaultScene.has_value()) {
         scene_index = asset.defaultScene.value();
     }
     const auto& node_indices = asset.scenes[scene_index].nodeIndices;
 
+    process_hierarchy(asset);
+
     nodes.reserve(node_indices.size());
     for (const size_t node_index : node_indices) {
         process_node(asset, node_index, glm::mat4(1.0f));
@@ -250,10 +641,23 @@ Model::Model(const fastgltf::Asset& asset) {
         process_texture(asset, image);
     }
 
-    spdlog::info("Loaded model with {} meshes, {} primitives, {} nodes, {} materials and {} textures",
+    skins.reserve(asset.skins.size());
+    for (const auto& skin : asset.skins) {
+        process_skin(asset, skin);
+    }
+
+    animations.reserve(asset.animations.size());
+    for (const auto& animation : asset.animations) {
+        process_animation(asset, animation);
+    }
+
+    spdlog::info("Loaded model with {} meshes, {} primitives, {} nodes, {} materials, {} textures, {} skins, {} animations and {} lights",
                  meshes.size(),
                  prim_count,
                  nodes.size(),
                  materials.size(),
-                 textures.size());
+                 textures.size(),
+                 skins.size(),
+                 animations.size(),
+                 lights.size());
 }
\ No newline at end of file
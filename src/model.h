@@ -1,5 +1,7 @@
 #pragma once
 
+#include "animation.h"
+#include "conditioning.h"
 #include "texture.h"
 
 #include <fastgltf/types.hpp>
@@ -7,19 +9,48 @@
 
 #include "common.h"
 
+// Points with normals become discs, points without them spheres and line primitives flat curve segments
+enum class PrimitiveShape : uint8_t {
+    Triangles,
+    Spheres,
+    Discs,
+    Curves
+};
+
 struct Primitive {
+    PrimitiveShape shape = PrimitiveShape::Triangles;
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
     uint32_t material_index;
+
+    std::vector<SkinVertex> skin; // Empty when the primitive has no JOINTS_0/WEIGHTS_0
+    std::vector<MorphDelta> morph_deltas; // Target-major, morph_target_count * vertices.size()
+    uint32_t morph_target_count = 0;
+
+    std::vector<std::vector<uint32_t>> lod_indices; // Simplified index lists over the same vertices, finest first
+
+    std::vector<ProceduralPrimitive> procedurals; // Analytic shapes, which keep no vertices or indices
 };
 
 struct Mesh {
     std::vector<Primitive> primitives;
+    std::vector<float> weights; // Default morph target weights, one per target
+
+    std::vector<float> lod_errors; // Object space error of every level in Primitive::lod_indices
+    glm::vec3 bounds_center{0.0f};
+    float bounds_radius = 0.0f;
 };
 
 struct Node {
     uint32_t mesh_index;
     glm::mat4 transform;
+    uint32_t node_index; // glTF node index into Model::hierarchy
+    uint32_t skin_index = UINT32_MAX;
+};
+
+struct Skin {
+    std::vector<uint32_t> joints; // glTF node indices
+    std::vector<glm::mat4> inverse_bind_matrices;
 };
 
 class Model {
@@ -27,6 +58,9 @@ class Model {
     void process_node(const fastgltf::Asset& asset, size_t node_index, const glm::mat4& parent_transform);
     void process_material(const fastgltf::Asset& asset, const fastgltf::Material& gltf_material);
     void process_texture(const fastgltf::Asset& asset, const fastgltf::Image& image);
+    void process_hierarchy(const fastgltf::Asset& asset);
+    void process_animation(const fastgltf::Asset& asset, const fastgltf::Animation& gltf_animation);
+    void process_skin(const fastgltf::Asset& asset, const fastgltf::Skin& gltf_skin);
 
 public:
     std::vector<Mesh> meshes;
@@ -34,5 +68,14 @@ public:
     std::vector<Material> materials;
     std::vector<TextureData> textures;
 
-    explicit Model(const fastgltf::Asset& asset);
+    std::vector<HierarchyNode> hierarchy;
+    std::vector<uint32_t> hierarchy_order; // Parents before children
+    std::vector<Animation> animations;
+    std::vector<Skin> skins;
+    std::vector<Light> lights; // Point and spot lights of KHR_lights_punctual, in model space
+
+    explicit Model(const fastgltf::Asset& asset, const ConditioningSettings& conditioning = {});
+
+    // Thread safe, only reads the model
+    void sample_pose(uint32_t animation_index, float time, Pose& pose) const;
 };
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include "opacity.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "jobs.h"
+
+constexpr size_t OPACITY_MIN_BATCH = 256;
+constexpr int64_t MAX_FOOTPRINT_TEXELS = 1 << 20; // Larger footprints are left to the any-hit shader
+
+// Outcome of the any-hit alpha test, blending accepts hits against a random cutoff in [0, 1)
+TriangleOpacity classify_alpha(const float alpha, const Material& material) {
+    if (material.alpha_mode == AlphaMode::Mask) {
+        return alpha >= material.alpha_cutoff ? TriangleOpacity::Opaque : TriangleOpacity::Transparent;
+    }
+    if (alpha >= 1.0f) return TriangleOpacity::Opaque;
+    if (alpha <= 0.0f) return TriangleOpacity::Transparent;
+    return TriangleOpacity::Mixed;
+}
+
+TriangleOpacity classify_triangle(const glm::vec2 (&uv)[3], const Material& material, const TextureData& albedo) {
+    const float base_alpha = material.base_color_factor.a;
+    const glm::vec2 size(albedo.width, albedo.height);
+
+    // Texel centers at integer coordinates, a bilinear lookup at p reads the texels within one texel of p
+    glm::vec2 p[3];
+    for (int i = 0; i < 3; ++i) {
+        p[i] = uv[i] * size - 0.5f;
+        if (!std::isfinite(p[i].x) || !std::isfinite(p[i].y)) return TriangleOpacity::Mixed;
+    }
+
+    const glm::vec2 lower = glm::floor(glm::min(p[0], glm::min(p[1], p[2]))) - 1.0f;
+    const glm::vec2 upper = glm::ceil(glm::max(p[0], glm::max(p[1], p[2]))) + 1.0f;
+    const auto x0 = static_cast<int64_t>(lower.x);
+    const auto y0 = static_cast<int64_t>(lower.y);
+    const auto x1 = static_cast<int64_t>(upper.x);
+    const auto y1 = static_cast<int64_t>(upper.y);
+    if ((x1 - x0 + 1) * (y1 - y0 + 1) > MAX_FOOTPRINT_TEXELS) return TriangleOpacity::Mixed;
+
+    // Edge functions grown by the lookup radius, degenerate UV triangles fall back to their bounding box
+    const glm::vec2 e01 = p[1] - p[0];
+    const glm::vec2 e02 = p[2] - p[0];
+    const float area = e01.x * e02.y - e01.y * e02.x;
+    const bool degenerate = std::abs(area) < 1e-8f;
+    const float orientation = area < 0.0f ? -1.0f : 1.0f;
+
+    const auto inside = [&](const glm::vec2& c) {
+        if (degenerate) return true;
+        for (int i = 0; i < 3; ++i) {
+            const glm::vec2& a = p[i];
+            const glm::vec2 d = p[(i + 1) % 3] - a;
+            const float edge = orientation * (d.x * (c.y - a.y) - d.y * (c.x - a.x));
+            if (edge < -(std::abs(d.x) + std::abs(d.y))) return false;
+        }
+        return true;
+    };
+
+    bool any_opaque = false;
+    bool any_transparent = false;
+    for (int64_t y = y0; y <= y1; ++y) {
+        for (int64_t x = x0; x <= x1; ++x) {
+            if (!inside(glm::vec2(x, y))) continue;
+
+            // Repeat addressing, same as the texture sampler
+            const int64_t tx = (x % albedo.width + albedo.width) % albedo.width;
+            const int64_t ty = (y % albedo.height + albedo.height) % albedo.height;
+            const float texel_alpha = albedo.data[(ty * albedo.width + tx) * 4 + 3] / 255.0f;
+
+            switch (classify_alpha(base_alpha * texel_alpha, material)) {
+                case TriangleOpacity::Opaque: any_opaque = true; break;
+                case TriangleOpacity::Transparent: any_transparent = true; break;
+                case TriangleOpacity::Mixed: return TriangleOpacity::Mixed;
+            }
+            if (any_opaque && any_transparent) return TriangleOpacity::Mixed;
+        }
+    }
+
+    if (any_opaque) return TriangleOpacity::Opaque;
+    if (any_transparent) return TriangleOpacity::Transparent;
+    return TriangleOpacity::Mixed;
+}
+
+void classify_triangle_opacity(const Primitive& primitive,
+                               const Material& material,
+                               const TextureData* albedo,
+                               const std::span<TriangleOpacity> opacities) {
+    // Without a texture every triangle shares the constant alpha of the material
+    if (!albedo || !albedo->data || albedo->width <= 0 || albedo->height <= 0) {
+        const TriangleOpacity opacity = albedo ? TriangleOpacity::Mixed
+                                               : classify_alpha(material.base_color_factor.a, material);
+        std::ranges::fill(opacities, opacity);
+        return;
+    }
+
+    JobSystem::parallel_for(opacities.size(), OPACITY_MIN_BATCH, [&](const size_t begin, const size_t end) {
+        for (size_t triangle = begin; triangle < end; ++triangle) {
+            const glm::vec2 uv[3] = {
+                primitive.vertices[primitive.indices[triangle * 3 + 0]].texcoord,
+                primitive.vertices[primitive.indices[triangle * 3 + 1]].texcoord,
+                primitive.vertices[primitive.indices[triangle * 3 + 2]].texcoord,
+            };
+            opacities[triangle] = classify_triangle(uv, material, *albedo);
+        }
+    });
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <span>
+
+#include "model.h"
+
+enum class TriangleOpacity : uint8_t {
+    Opaque,
+    Transparent,
+    Mixed // Needs the any-hit shader
+};
+
+/**
+ * Conservative opacity of every triangle of an alpha tested primitive. Every texel that a bilinear lookup inside
+ * the triangle's UV footprint can reach is tested against the material's alpha, so a triangle is only opaque or
+ * transparent when the any-hit shader would accept or ignore all of its hits
+ * Web: https://registry.khronos.org/vulkan/specs/latest/man/html/VK_EXT_opacity_micromap.html
+ */
+void classify_triangle_opacity(const Primitive& primitive,
+                               const Material& material,
+                               const TextureData* albedo,
+                               std::span<TriangleOpacity> opacities);
\ No newline at end of file
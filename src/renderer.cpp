@@ -12,6 +12,7 @@
 #include "vulkan/utils.h"
 #include "camera.h"
 #include "gui.h"
+#include "sample_sequence.h"
 #include "window.h"
 #include "vulkan/sbt.h"
 
@@ -19,7 +20,8 @@ RayTracingPipeline create_rt_pipeline(const Context& ctx, const vk::raii::Descri
     constexpr vk::PushConstantRange rt_push_constant_range{
         .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR |
                       vk::ShaderStageFlagBits::eClosestHitKHR |
-                      vk::ShaderStageFlagBits::eAnyHitKHR,
+                      vk::ShaderStageFlagBits::eAnyHitKHR |
+                      vk::ShaderStageFlagBits::eIntersectionKHR,
         .offset = 0,
         .size = sizeof(PushData)
     };
@@ -33,6 +35,12 @@ RayTracingPipeline create_rt_pipeline(const Context& ctx, const vk::raii::Descri
            .rmiss_group((spirv_dir / "raytrace.rmiss.spv").string())
            .hit_group((spirv_dir / "raytrace.rchit.spv").string(), std::nullopt)
            .hit_group((spirv_dir / "raytrace.rchit.spv").string(), (spirv_dir / "raytrace.rahit.spv").string())
+           .procedural_hit_group((spirv_dir / "raytrace.sphere.rint.spv").string(),
+                                 (spirv_dir / "raytrace.procedural.rchit.spv").string())
+           .procedural_hit_group((spirv_dir / "raytrace.disc.rint.spv").string(),
+                                 (spirv_dir / "raytrace.procedural.rchit.spv").string())
+           .procedural_hit_group((spirv_dir / "raytrace.curve.rint.spv").string(),
+                                 (spirv_dir / "raytrace.procedural.rchit.spv").string())
            .descriptor_set_layout(layout)
            .descriptor_set_layout(ctx.get_bindless_layout())
            .push_constant_range(rt_push_constant_range)
@@ -57,6 +65,74 @@ ComputePipeline create_compute_pipeline(const Context& ctx, const vk::raii::Desc
            .build(ctx.get_device());
 }
 
+ComputePipeline create_deform_pipeline(const Context& ctx) {
+    constexpr vk::PushConstantRange deform_push_constant_range{
+        .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        .offset = 0,
+        .size = sizeof(DeformPushData)
+    };
+
+    const auto exec_path = utils::get_exec_path();
+    const auto build_dir = exec_path.parent_path();
+    const auto spirv_dir = build_dir.parent_path() / "src" / "shaders" / "spirv";
+
+    return ComputePipelineBuilder()
+           .stage((spirv_dir / "deform.spv").string())
+           .push_constant_range(deform_push_constant_range)
+           .build(ctx.get_device());
+}
+
+ComputePipeline create_sky_pipeline(const Context& ctx,
+                                    const vk::raii::DescriptorSetLayout& layout,
+                                    const std::string& shader) {
+    constexpr vk::PushConstantRange sky_push_constant_range{
+        .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        .offset = 0,
+        .size = sizeof(PushData)
+    };
+
+    const auto exec_path = utils::get_exec_path();
+    const auto build_dir = exec_path.parent_path();
+    const auto spirv_dir = build_dir.parent_path() / "src" / "shaders" / "spirv";
+
+    return ComputePipelineBuilder()
+           .stage((spirv_dir / (shader + ".spv")).string())
+           .descriptor_set_layout(layout)
+           .push_constant_range(sky_push_constant_range)
+           .build(ctx.get_device());
+}
+
+ComputePipeline create_guiding_pipeline(const Context& ctx, const vk::raii::DescriptorSetLayout& layout) {
+    const auto exec_path = utils::get_exec_path();
+    const auto build_dir = exec_path.parent_path();
+    const auto spirv_dir = build_dir.parent_path() / "src" / "shaders" / "spirv";
+
+    return ComputePipelineBuilder()
+           .stage((spirv_dir / "guiding_refit.spv").string())
+           .descriptor_set_layout(layout)
+           .build(ctx.get_device());
+}
+
+// Storage buffer only the shaders touch, cleared on the GPU
+Buffer create_zeroed_buffer(const Context& ctx, const vk::raii::CommandBuffer& cmd, const vk::DeviceSize size) {
+    auto buffer = BufferBuilder()
+                  .size(size)
+                  .usage(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst)
+                  .build(ctx.get_allocator());
+
+    cmd.fillBuffer(buffer.get(), 0, vk::WholeSize, 0);
+
+    return buffer;
+}
+
+// Zeroed, so the first frame finds no reservoirs to reuse
+Buffer create_reservoir_buffer(const Context& ctx,
+                               const vk::raii::CommandBuffer& cmd,
+                               const vk::Extent2D extent,
+                               const vk::DeviceSize reservoir_size) {
+    return create_zeroed_buffer(ctx, cmd, static_cast<vk::DeviceSize>(extent.width) * extent.height * reservoir_size);
+}
+
 ShaderBindingTable create_sbt(const Context& ctx, const RayTracingPipeline& rt_pipeline) {
     return ShaderBindingTable(ctx.get_adapter(), ctx.get_device(), rt_pipeline, ctx.get_allocator());
 }
@@ -112,6 +188,62 @@ Renderer::Renderer(Context& ctx_) : ctx(ctx_) {
                                 vk::PipelineStageFlagBits2::eComputeShader,
                                 vk::AccessFlagBits2::eShaderWrite);
 
+    // Sky Lookup Tables
+
+    auto transmittance_lut = ImageBuilder()
+                             .type(vk::ImageType::e2D)
+                             .format(vk::Format::eR16G16B16A16Sfloat)
+                             .size(TRANSMITTANCE_LUT_WIDTH, TRANSMITTANCE_LUT_HEIGHT)
+                             .mip_levels(1)
+                             .layers(1)
+                             .samples(vk::SampleCountFlagBits::e1)
+                             .usage(vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled)
+                             .build(ctx.get_allocator());
+
+    auto transmittance_lut_view =
+        ImageView(ctx.get_device(), transmittance_lut, vk::ImageViewType::e2D, vk::ImageAspectFlagBits::eColor, 0, 1);
+
+    transmittance_lut.transition_layout(single_time_encoder.get_cmd(),
+                                        vk::ImageLayout::eGeneral,
+                                        vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+                                        vk::AccessFlagBits2::eShaderSampledRead);
+
+    // Rayleigh and Mie layers
+    auto sky_view_lut = ImageBuilder()
+                        .type(vk::ImageType::e2D)
+                        .format(vk::Format::eR16G16B16A16Sfloat)
+                        .size(SKY_VIEW_LUT_WIDTH, SKY_VIEW_LUT_HEIGHT)
+                        .mip_levels(1)
+                        .layers(2)
+                        .samples(vk::SampleCountFlagBits::e1)
+                        .usage(vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled)
+                        .build(ctx.get_allocator());
+
+    auto sky_view_lut_view =
+        ImageView(ctx.get_device(), sky_view_lut, vk::ImageViewType::e2DArray, vk::ImageAspectFlagBits::eColor, 0, 1);
+
+    sky_view_lut.transition_layout(single_time_encoder.get_cmd(),
+                                   vk::ImageLayout::eGeneral,
+                                   vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+                                   vk::AccessFlagBits2::eShaderSampledRead);
+
+    // ReSTIR Reservoirs
+
+    const auto& fill_cmd = single_time_encoder.get_cmd();
+    const auto extent = swapchain->get_extent();
+    auto reservoirs = create_reservoir_buffer(ctx, fill_cmd, extent, sizeof(Reservoir));
+    auto previous_reservoirs = create_reservoir_buffer(ctx, fill_cmd, extent, sizeof(Reservoir));
+    auto gi_reservoirs = create_reservoir_buffer(ctx, fill_cmd, extent, sizeof(GiReservoir));
+    auto previous_gi_reservoirs = create_reservoir_buffer(ctx, fill_cmd, extent, sizeof(GiReservoir));
+
+    // Path Guiding Cache
+
+    constexpr vk::DeviceSize guiding_bins = static_cast<vk::DeviceSize>(GUIDING_CELLS) * GUIDING_BINS;
+    auto guiding_keys = create_zeroed_buffer(ctx, fill_cmd, GUIDING_CELLS * sizeof(uint32_t));
+    auto guiding_splats = create_zeroed_buffer(ctx, fill_cmd, guiding_bins * sizeof(uint32_t));
+    auto guiding_energies = create_zeroed_buffer(ctx, fill_cmd, guiding_bins * sizeof(float));
+    auto guiding_cdfs = create_zeroed_buffer(ctx, fill_cmd, guiding_bins * sizeof(float));
+
     single_time_encoder.submit(ctx.get_device());
 
     // Ray Tracing Push Descriptors
@@ -142,6 +274,32 @@ Renderer::Renderer(Context& ctx_) : ctx(ctx_) {
     };
     rt_push_bindings.push_back(uniform_binding);
 
+    vk::DescriptorSetLayoutBinding transmittance_lut_binding{
+        .binding = 3,
+        .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+        .descriptorCount = 1,
+        .stageFlags = vk::ShaderStageFlagBits::eAll,
+    };
+    rt_push_bindings.push_back(transmittance_lut_binding);
+
+    vk::DescriptorSetLayoutBinding sky_view_lut_binding{
+        .binding = 4,
+        .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+        .descriptorCount = 1,
+        .stageFlags = vk::ShaderStageFlagBits::eAll,
+    };
+    rt_push_bindings.push_back(sky_view_lut_binding);
+
+    // ReSTIR DI and GI reservoirs for the current and previous frame, then the path guiding cache
+    for (uint32_t binding = 5; binding < 12; binding++) {
+        rt_push_bindings.push_back(vk::DescriptorSetLayoutBinding{
+            .binding = binding,
+            .descriptorType = vk::DescriptorType::eStorageBuffer,
+            .descriptorCount = 1,
+            .stageFlags = vk::ShaderStageFlagBits::eAll,
+        });
+    }
+
     // Ray Tracing Descriptor set layouts
 
     vk::DescriptorSetLayoutCreateInfo rt_push_descriptor_set_layout_info{
@@ -173,6 +331,57 @@ Renderer::Renderer(Context& ctx_) : ctx(ctx_) {
     auto compute_push_descriptor_set_layout =
         ctx.get_device().get().createDescriptorSetLayout(compute_push_descriptor_set_layout_info);
 
+    // Sky Push Descriptors
+
+    std::vector<vk::DescriptorSetLayoutBinding> sky_push_bindings;
+
+    for (uint32_t binding = 0; binding < 2; binding++) {
+        sky_push_bindings.push_back(vk::DescriptorSetLayoutBinding{
+            .binding = binding,
+            .descriptorType = vk::DescriptorType::eStorageImage,
+            .descriptorCount = 1,
+            .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        });
+    }
+
+    // The sky view pass reads the transmittance table through a sampler
+    vk::DescriptorSetLayoutBinding sky_transmittance_binding{
+        .binding = 2,
+        .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+        .descriptorCount = 1,
+        .stageFlags = vk::ShaderStageFlagBits::eCompute,
+    };
+    sky_push_bindings.push_back(sky_transmittance_binding);
+
+    vk::DescriptorSetLayoutCreateInfo sky_push_descriptor_set_layout_info{
+        .flags = vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptor,
+        .bindingCount = static_cast<uint32_t>(sky_push_bindings.size()),
+        .pBindings = sky_push_bindings.data(),
+    };
+    auto sky_push_descriptor_set_layout =
+        ctx.get_device().get().createDescriptorSetLayout(sky_push_descriptor_set_layout_info);
+
+    // Guiding Push Descriptors
+
+    std::vector<vk::DescriptorSetLayoutBinding> guiding_push_bindings;
+
+    for (uint32_t binding = 0; binding < 4; binding++) {
+        guiding_push_bindings.push_back(vk::DescriptorSetLayoutBinding{
+            .binding = binding,
+            .descriptorType = vk::DescriptorType::eStorageBuffer,
+            .descriptorCount = 1,
+            .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        });
+    }
+
+    vk::DescriptorSetLayoutCreateInfo guiding_push_descriptor_set_layout_info{
+        .flags = vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptor,
+        .bindingCount = static_cast<uint32_t>(guiding_push_bindings.size()),
+        .pBindings = guiding_push_bindings.data(),
+    };
+    auto guiding_push_descriptor_set_layout =
+        ctx.get_device().get().createDescriptorSetLayout(guiding_push_descriptor_set_layout_info);
+
     // Ray Tracing Pipeline
 
     auto rt_pipeline = create_rt_pipeline(ctx, rt_push_descriptor_set_layout);
@@ -181,6 +390,19 @@ Renderer::Renderer(Context& ctx_) : ctx(ctx_) {
 
     auto compute_pipeline = create_compute_pipeline(ctx, compute_push_descriptor_set_layout);
 
+    // Skinning and Morph Target Pipeline
+
+    auto deform_pipeline = create_deform_pipeline(ctx);
+
+    // Sky Lookup Table Pipelines
+
+    auto transmittance_pipeline = create_sky_pipeline(ctx, sky_push_descriptor_set_layout, "transmittance_lut");
+    auto sky_view_pipeline = create_sky_pipeline(ctx, sky_push_descriptor_set_layout, "sky_view_lut");
+
+    // Path Guiding Refit Pipeline
+
+    auto guiding_pipeline = create_guiding_pipeline(ctx, guiding_push_descriptor_set_layout);
+
     // Shader Binding Table
 
     auto sbt = create_sbt(ctx, rt_pipeline);
@@ -190,6 +412,27 @@ Renderer::Renderer(Context& ctx_) : ctx(ctx_) {
     encoder = std::make_unique<Encoder>(ctx.get_device(), frames_in_flight);
     frame_mgr = std::make_unique<FrameManager>(ctx, frames_in_flight, swapchain->get_images().size());
 
+    // Sampler Tables
+
+    const auto sobol_matrices = build_sobol_matrices(SOBOL_DIMENSIONS);
+    const auto blue_noise = build_blue_noise(BLUE_NOISE_SIZE, 0);
+
+    auto sobol_matrices_buffer = BufferBuilder()
+                                 .size(sobol_matrices.size() * sizeof(uint32_t))
+                                 .usage(vk::BufferUsageFlagBits::eShaderDeviceAddress)
+                                 .allocation_flags(VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                                                   VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                                 .build(ctx.get_allocator());
+    memcpy(sobol_matrices_buffer.mapped_ptr(), sobol_matrices.data(), sobol_matrices.size() * sizeof(uint32_t));
+
+    auto blue_noise_buffer = BufferBuilder()
+                             .size(blue_noise.size() * sizeof(float))
+                             .usage(vk::BufferUsageFlagBits::eShaderDeviceAddress)
+                             .allocation_flags(VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                                               VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                             .build(ctx.get_allocator());
+    memcpy(blue_noise_buffer.mapped_ptr(), blue_noise.data(), blue_noise.size() * sizeof(float));
+
     RenderSettings render_settings{
         .debug_channel = DebugChannel::None,
         .samples = 1,
@@ -204,7 +447,23 @@ Renderer::Renderer(Context& ctx_) : ctx(ctx_) {
         .sun_color = glm::vec3(1.0f),
         .sun_emission = 50'000.0f,
         .sun_radius = 0.01,
-        .light_emission = 1.0f
+        .light_emission = 1.0f,
+        .light_sampling = LightSampling::LightTree,
+        .triangle_sampling = TriangleSampling::SolidAngle,
+        .environment_emission = 1.0f,
+        .environment_map = {},
+        .sample_sequence = SampleSequence::Sobol,
+        .sampler_tables = {
+            .sobol_matrices = sobol_matrices_buffer.get_device_address(ctx.get_device()),
+            .blue_noise = blue_noise_buffer.get_device_address(ctx.get_device())
+        },
+        .russian_roulette = RussianRoulette::Enabled,
+        .path_regeneration = PathRegeneration::Enabled,
+        .restir_di = RestirDi::None,
+        .restir_candidates = 32,
+        .path_guiding = PathGuiding::None,
+        .guiding_cell_size = 0.5f,
+        .guiding_probability = 0.5f
     };
 
     auto render_settings_buffer = BufferBuilder()
@@ -223,19 +482,39 @@ Renderer::Renderer(Context& ctx_) : ctx(ctx_) {
         .surface = std::move(surface),
         .rt_descriptor_set_layout = std::move(rt_push_descriptor_set_layout),
         .compute_descriptor_set_layout = std::move(compute_push_descriptor_set_layout),
+        .sky_descriptor_set_layout = std::move(sky_push_descriptor_set_layout),
+        .guiding_descriptor_set_layout = std::move(guiding_push_descriptor_set_layout),
         .rt_pipeline = std::move(rt_pipeline),
         .compute_pipeline = std::move(compute_pipeline),
+        .deform_pipeline = std::move(deform_pipeline),
+        .transmittance_pipeline = std::move(transmittance_pipeline),
+        .sky_view_pipeline = std::move(sky_view_pipeline),
+        .guiding_pipeline = std::move(guiding_pipeline),
         .sbt = std::move(sbt),
         .rt_image = std::move(rt_image),
         .out_image = std::move(out_image),
         .rt_image_view = std::move(rt_image_view),
         .out_image_view = std::move(out_image_view),
+        .transmittance_lut = std::move(transmittance_lut),
+        .sky_view_lut = std::move(sky_view_lut),
+        .transmittance_lut_view = std::move(transmittance_lut_view),
+        .sky_view_lut_view = std::move(sky_view_lut_view),
         .render_settings = render_settings,
         .render_settings_buffer = std::move(render_settings_buffer),
+        .sobol_matrices_buffer = std::move(sobol_matrices_buffer),
+        .blue_noise_buffer = std::move(blue_noise_buffer),
+        .reservoirs = std::move(reservoirs),
+        .previous_reservoirs = std::move(previous_reservoirs),
+        .gi_reservoirs = std::move(gi_reservoirs),
+        .previous_gi_reservoirs = std::move(previous_gi_reservoirs),
+        .guiding_keys = std::move(guiding_keys),
+        .guiding_splats = std::move(guiding_splats),
+        .guiding_energies = std::move(guiding_energies),
+        .guiding_cdfs = std::move(guiding_cdfs),
     });
 }
 
-void Renderer::draw_frame(const Scene& scene) {
+void Renderer::draw_frame(Scene& scene) {
     (void) ctx.get_device().get().waitForFences({frame_mgr->get_in_flight_fence()},
                                                 vk::True,
                                                 std::numeric_limits<uint64_t>::max());
@@ -260,6 +539,11 @@ void Renderer::draw_frame(const Scene& scene) {
     encoder->begin(frame_mgr->get_frame_index());
     auto& cmd = encoder->get_cmd();
 
+    // Moving scenes keep tracing and blend only the last few frames
+    const bool moving_scene = scene.is_animating();
+
+    scene.record_updates(ctx, cmd, frame_mgr->get_frame_index(), res->deform_pipeline);
+
     // Ray Tracing writes
 
     vk::WriteDescriptorSetAccelerationStructureKHR write_as_info{
@@ -290,7 +574,9 @@ void Renderer::draw_frame(const Scene& scene) {
     auto uniform = Uniform{
         .inv_view = glm::inverse(camera.get_view()),
         .inv_proj = glm::inverse(camera.get_proj()),
+        .prev_view_proj = prev_view_proj,
     };
+    prev_view_proj = camera.get_proj() * camera.get_view();
     auto& uniform_buffer = frame_mgr->get_uniform_buffer();
 
     bool frame_reset = false;
@@ -314,7 +600,128 @@ void Renderer::draw_frame(const Scene& scene) {
         .pBufferInfo = &descriptor_uniform_info,
     };
 
-    std::vector rt_writes{rt_write_as, rt_write_image, rt_write_uniform};
+    vk::DescriptorImageInfo transmittance_lut_info{
+        .sampler = ctx.get_linear_sampler().get(),
+        .imageView = res->transmittance_lut_view.get(),
+        .imageLayout = vk::ImageLayout::eGeneral,
+    };
+
+    vk::WriteDescriptorSet rt_write_transmittance_lut{
+        .dstBinding = 3,
+        .descriptorCount = 1,
+        .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+        .pImageInfo = &transmittance_lut_info,
+    };
+
+    vk::DescriptorImageInfo sky_view_lut_info{
+        .sampler = ctx.get_linear_sampler().get(),
+        .imageView = res->sky_view_lut_view.get(),
+        .imageLayout = vk::ImageLayout::eGeneral,
+    };
+
+    vk::WriteDescriptorSet rt_write_sky_view_lut{
+        .dstBinding = 4,
+        .descriptorCount = 1,
+        .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+        .pImageInfo = &sky_view_lut_info,
+    };
+
+    vk::DescriptorBufferInfo reservoirs_info{
+        .buffer = res->reservoirs.get(),
+        .offset = 0,
+        .range = vk::WholeSize,
+    };
+
+    vk::WriteDescriptorSet rt_write_reservoirs{
+        .dstBinding = 5,
+        .descriptorCount = 1,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .pBufferInfo = &reservoirs_info,
+    };
+
+    vk::DescriptorBufferInfo previous_reservoirs_info{
+        .buffer = res->previous_reservoirs.get(),
+        .offset = 0,
+        .range = vk::WholeSize,
+    };
+
+    vk::WriteDescriptorSet rt_write_previous_reservoirs{
+        .dstBinding = 6,
+        .descriptorCount = 1,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .pBufferInfo = &previous_reservoirs_info,
+    };
+
+    vk::DescriptorBufferInfo gi_reservoirs_info{
+        .buffer = res->gi_reservoirs.get(),
+        .offset = 0,
+        .range = vk::WholeSize,
+    };
+
+    vk::WriteDescriptorSet rt_write_gi_reservoirs{
+        .dstBinding = 7,
+        .descriptorCount = 1,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .pBufferInfo = &gi_reservoirs_info,
+    };
+
+    vk::DescriptorBufferInfo previous_gi_reservoirs_info{
+        .buffer = res->previous_gi_reservoirs.get(),
+        .offset = 0,
+        .range = vk::WholeSize,
+    };
+
+    vk::WriteDescriptorSet rt_write_previous_gi_reservoirs{
+        .dstBinding = 8,
+        .descriptorCount = 1,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .pBufferInfo = &previous_gi_reservoirs_info,
+    };
+
+    vk::DescriptorBufferInfo guiding_keys_info{
+        .buffer = res->guiding_keys.get(),
+        .offset = 0,
+        .range = vk::WholeSize,
+    };
+
+    vk::DescriptorBufferInfo guiding_splats_info{
+        .buffer = res->guiding_splats.get(),
+        .offset = 0,
+        .range = vk::WholeSize,
+    };
+
+    vk::DescriptorBufferInfo guiding_cdfs_info{
+        .buffer = res->guiding_cdfs.get(),
+        .offset = 0,
+        .range = vk::WholeSize,
+    };
+
+    vk::WriteDescriptorSet rt_write_guiding_keys{
+        .dstBinding = 9,
+        .descriptorCount = 1,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .pBufferInfo = &guiding_keys_info,
+    };
+
+    vk::WriteDescriptorSet rt_write_guiding_splats{
+        .dstBinding = 10,
+        .descriptorCount = 1,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .pBufferInfo = &guiding_splats_info,
+    };
+
+    vk::WriteDescriptorSet rt_write_guiding_cdfs{
+        .dstBinding = 11,
+        .descriptorCount = 1,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .pBufferInfo = &guiding_cdfs_info,
+    };
+
+    std::vector rt_writes{
+        rt_write_as, rt_write_image, rt_write_uniform, rt_write_transmittance_lut, rt_write_sky_view_lut,
+        rt_write_reservoirs, rt_write_previous_reservoirs, rt_write_gi_reservoirs, rt_write_previous_gi_reservoirs,
+        rt_write_guiding_keys, rt_write_guiding_splats, rt_write_guiding_cdfs
+    };
 
     // Compute writes
 
@@ -346,14 +753,17 @@ void Renderer::draw_frame(const Scene& scene) {
         .render_settings = res->render_settings_buffer.get_device_address(ctx.get_device()),
         .frame_count = frame_count,
         .num_lights = scene.get_num_lights(),
-        .sun_dir = sun_dir
+        .num_light_instances = scene.get_num_light_instances(),
+        .sun_dir = sun_dir,
+        .accumulation_limit = moving_scene ? motion_history : 0
     };
 
     vk::PushConstantsInfo rt_push_constants_info{
         .layout = res->rt_pipeline.get_layout(),
         .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR |
                       vk::ShaderStageFlagBits::eClosestHitKHR |
-                      vk::ShaderStageFlagBits::eAnyHitKHR,
+                      vk::ShaderStageFlagBits::eAnyHitKHR |
+                      vk::ShaderStageFlagBits::eIntersectionKHR,
         .offset = 0,
         .size = sizeof(PushData),
         .pValues = &push_data,
@@ -377,7 +787,26 @@ void Renderer::draw_frame(const Scene& scene) {
         .pDescriptorSets = &*scene.get_descriptor_set()
     };
 
-    if (frame_count <= res->render_settings.iterations) {
+    if (moving_scene || frame_count <= res->render_settings.iterations) {
+        // The tables stay valid while another environment is shown, so switching back does not rebake
+        if (res->render_settings.environment_type == EnvironmentType::Procedural &&
+            (sky_dirty || sun_dir != baked_sun_dir)) {
+            bake_sky(cmd, push_data);
+        }
+
+        // Last frame wrote the reservoirs this one reads
+        vk::MemoryBarrier2 reservoir_barrier{
+            .srcStageMask = vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+            .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+            .dstStageMask = vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+            .dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite,
+        };
+
+        cmd.pipelineBarrier2(vk::DependencyInfo{
+            .memoryBarrierCount = 1,
+            .pMemoryBarriers = &reservoir_barrier,
+        });
+
         cmd.bindPipeline(vk::PipelineBindPoint::eRayTracingKHR, res->rt_pipeline.get());
         cmd.pushDescriptorSet(vk::PipelineBindPoint::eRayTracingKHR, res->rt_pipeline.get_layout(), 0, rt_writes);
         cmd.bindDescriptorSets2(bind_sets_info);
@@ -391,6 +820,13 @@ void Renderer::draw_frame(const Scene& scene) {
                          swapchain->get_extent().height,
                          1);
 
+        std::swap(res->reservoirs, res->previous_reservoirs);
+        std::swap(res->gi_reservoirs, res->previous_gi_reservoirs);
+
+        if (res->render_settings.path_guiding == PathGuiding::Enabled) {
+            refit_guiding(cmd);
+        }
+
         res->rt_image.transition_layout(cmd,
                                         vk::ImageLayout::eGeneral,
                                         vk::PipelineStageFlagBits2::eComputeShader,
@@ -509,11 +945,151 @@ void Renderer::draw_frame(const Scene& scene) {
 
     frame_mgr->update();
 
-    if (!frame_reset && frame_count <= res->render_settings.iterations) {
+    if (!frame_reset && (moving_scene || frame_count <= res->render_settings.iterations)) {
         frame_count++;
     }
 }
 
+void Renderer::bake_sky(const vk::raii::CommandBuffer& cmd, const PushData& push_data) {
+    res->transmittance_lut.transition_layout(cmd,
+                                             vk::ImageLayout::eGeneral,
+                                             vk::PipelineStageFlagBits2::eComputeShader,
+                                             vk::AccessFlagBits2::eShaderStorageWrite);
+
+    res->sky_view_lut.transition_layout(cmd,
+                                        vk::ImageLayout::eGeneral,
+                                        vk::PipelineStageFlagBits2::eComputeShader,
+                                        vk::AccessFlagBits2::eShaderStorageWrite);
+
+    vk::DescriptorImageInfo transmittance_storage_info{
+        .imageView = res->transmittance_lut_view.get(),
+        .imageLayout = vk::ImageLayout::eGeneral,
+    };
+
+    vk::DescriptorImageInfo sky_view_storage_info{
+        .imageView = res->sky_view_lut_view.get(),
+        .imageLayout = vk::ImageLayout::eGeneral,
+    };
+
+    vk::DescriptorImageInfo transmittance_sampled_info{
+        .sampler = ctx.get_linear_sampler().get(),
+        .imageView = res->transmittance_lut_view.get(),
+        .imageLayout = vk::ImageLayout::eGeneral,
+    };
+
+    std::vector sky_writes{
+        vk::WriteDescriptorSet{
+            .dstBinding = 0,
+            .descriptorCount = 1,
+            .descriptorType = vk::DescriptorType::eStorageImage,
+            .pImageInfo = &transmittance_storage_info,
+        },
+        vk::WriteDescriptorSet{
+            .dstBinding = 1,
+            .descriptorCount = 1,
+            .descriptorType = vk::DescriptorType::eStorageImage,
+            .pImageInfo = &sky_view_storage_info,
+        },
+        vk::WriteDescriptorSet{
+            .dstBinding = 2,
+            .descriptorCount = 1,
+            .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+            .pImageInfo = &transmittance_sampled_info,
+        },
+    };
+
+    // Transmittance
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, res->transmittance_pipeline.get());
+    cmd.pushDescriptorSet(vk::PipelineBindPoint::eCompute, res->transmittance_pipeline.get_layout(), 0, sky_writes);
+
+    cmd.dispatch((TRANSMITTANCE_LUT_WIDTH + 8 - 1) / 8, (TRANSMITTANCE_LUT_HEIGHT + 8 - 1) / 8, 1);
+
+    res->transmittance_lut.transition_layout(cmd,
+                                             vk::ImageLayout::eGeneral,
+                                             vk::PipelineStageFlagBits2::eComputeShader,
+                                             vk::AccessFlagBits2::eShaderSampledRead);
+
+    // Sky View
+
+    vk::PushConstantsInfo sky_push_constants_info{
+        .layout = res->sky_view_pipeline.get_layout(),
+        .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        .offset = 0,
+        .size = sizeof(PushData),
+        .pValues = &push_data,
+    };
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, res->sky_view_pipeline.get());
+    cmd.pushDescriptorSet(vk::PipelineBindPoint::eCompute, res->sky_view_pipeline.get_layout(), 0, sky_writes);
+    cmd.pushConstants2(sky_push_constants_info);
+
+    cmd.dispatch((SKY_VIEW_LUT_WIDTH + 8 - 1) / 8, (SKY_VIEW_LUT_HEIGHT + 8 - 1) / 8, 1);
+
+    res->transmittance_lut.transition_layout(cmd,
+                                             vk::ImageLayout::eGeneral,
+                                             vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+                                             vk::AccessFlagBits2::eShaderSampledRead);
+
+    res->sky_view_lut.transition_layout(cmd,
+                                        vk::ImageLayout::eGeneral,
+                                        vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+                                        vk::AccessFlagBits2::eShaderSampledRead);
+
+    baked_sun_dir = sun_dir;
+    sky_dirty = false;
+}
+
+void Renderer::refit_guiding(const vk::raii::CommandBuffer& cmd) {
+    // Splats of this frame are complete before they are folded in
+    vk::MemoryBarrier2 splat_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+        .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite,
+    };
+
+    cmd.pipelineBarrier2(vk::DependencyInfo{
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &splat_barrier,
+    });
+
+    std::vector guiding_infos{
+        vk::DescriptorBufferInfo{.buffer = res->guiding_keys.get(), .offset = 0, .range = vk::WholeSize},
+        vk::DescriptorBufferInfo{.buffer = res->guiding_splats.get(), .offset = 0, .range = vk::WholeSize},
+        vk::DescriptorBufferInfo{.buffer = res->guiding_energies.get(), .offset = 0, .range = vk::WholeSize},
+        vk::DescriptorBufferInfo{.buffer = res->guiding_cdfs.get(), .offset = 0, .range = vk::WholeSize},
+    };
+
+    std::vector<vk::WriteDescriptorSet> guiding_writes;
+    for (uint32_t binding = 0; binding < guiding_infos.size(); binding++) {
+        guiding_writes.push_back(vk::WriteDescriptorSet{
+            .dstBinding = binding,
+            .descriptorCount = 1,
+            .descriptorType = vk::DescriptorType::eStorageBuffer,
+            .pBufferInfo = &guiding_infos[binding],
+        });
+    }
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, res->guiding_pipeline.get());
+    cmd.pushDescriptorSet(vk::PipelineBindPoint::eCompute, res->guiding_pipeline.get_layout(), 0, guiding_writes);
+
+    cmd.dispatch((GUIDING_CELLS + 64 - 1) / 64, 1, 1);
+
+    // The next frame samples the new distributions and splats into the cleared bins
+    vk::MemoryBarrier2 refit_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+        .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite,
+    };
+
+    cmd.pipelineBarrier2(vk::DependencyInfo{
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &refit_barrier,
+    });
+}
+
 void Renderer::recreate() {
     SCOPED_TIMER();
 
@@ -562,6 +1138,15 @@ void Renderer::recreate() {
                                      vk::PipelineStageFlagBits2::eComputeShader,
                                      vk::AccessFlagBits2::eShaderStorageWrite);
 
+    // ReSTIR Reservoirs
+
+    const auto& fill_cmd = single_time_encoder.get_cmd();
+    const auto extent = swapchain->get_extent();
+    res->reservoirs = create_reservoir_buffer(ctx, fill_cmd, extent, sizeof(Reservoir));
+    res->previous_reservoirs = create_reservoir_buffer(ctx, fill_cmd, extent, sizeof(Reservoir));
+    res->gi_reservoirs = create_reservoir_buffer(ctx, fill_cmd, extent, sizeof(GiReservoir));
+    res->previous_gi_reservoirs = create_reservoir_buffer(ctx, fill_cmd, extent, sizeof(GiReservoir));
+
     single_time_encoder.submit(ctx.get_device());
 
     // Image views
@@ -593,6 +1178,11 @@ void Renderer::reload_shaders() {
     utils::run_bash_script("bash " + (shader_dir / "compile.sh").string());
     res->rt_pipeline = create_rt_pipeline(ctx, res->rt_descriptor_set_layout);
     res->compute_pipeline = create_compute_pipeline(ctx, res->compute_descriptor_set_layout);
+    res->deform_pipeline = create_deform_pipeline(ctx);
+    res->transmittance_pipeline = create_sky_pipeline(ctx, res->sky_descriptor_set_layout, "transmittance_lut");
+    res->sky_view_pipeline = create_sky_pipeline(ctx, res->sky_descriptor_set_layout, "sky_view_lut");
+    res->guiding_pipeline = create_guiding_pipeline(ctx, res->guiding_descriptor_set_layout);
     res->sbt = create_sbt(ctx, res->rt_pipeline);
+    sky_dirty = true;
     frame_count = 1;
 }
\ No newline at end of file
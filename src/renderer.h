@@ -15,9 +15,15 @@ struct Resources {
 
     vk::raii::DescriptorSetLayout rt_descriptor_set_layout;
     vk::raii::DescriptorSetLayout compute_descriptor_set_layout;
+    vk::raii::DescriptorSetLayout sky_descriptor_set_layout;
+    vk::raii::DescriptorSetLayout guiding_descriptor_set_layout;
 
     RayTracingPipeline rt_pipeline;
     ComputePipeline compute_pipeline;
+    ComputePipeline deform_pipeline;
+    ComputePipeline transmittance_pipeline;
+    ComputePipeline sky_view_pipeline;
+    ComputePipeline guiding_pipeline;
 
     ShaderBindingTable sbt;
 
@@ -26,8 +32,28 @@ struct Resources {
     ImageView rt_image_view;
     ImageView out_image_view;
 
+    // Procedural sky, only rebaked when the sun moves
+    Image transmittance_lut;
+    Image sky_view_lut;
+    ImageView transmittance_lut_view;
+    ImageView sky_view_lut_view;
+
     RenderSettings render_settings;
     Buffer render_settings_buffer;
+    Buffer sobol_matrices_buffer;
+    Buffer blue_noise_buffer;
+
+    // ReSTIR DI and GI, swapped every frame so the previous reservoirs stay readable
+    Buffer reservoirs;
+    Buffer previous_reservoirs;
+    Buffer gi_reservoirs;
+    Buffer previous_gi_reservoirs;
+
+    // Path guiding cache, world space so it survives resizes
+    Buffer guiding_keys;
+    Buffer guiding_splats;
+    Buffer guiding_energies;
+    Buffer guiding_cdfs;
 };
 
 class Renderer {
@@ -40,12 +66,21 @@ class Renderer {
 
     uint32_t frame_count = 1;
 
+    glm::vec3 baked_sun_dir{};
+    bool sky_dirty = true;
+
+    glm::mat4 prev_view_proj{1.0f};
+
+    void bake_sky(const vk::raii::CommandBuffer& cmd, const PushData& push_data);
+    void refit_guiding(const vk::raii::CommandBuffer& cmd);
+
 public:
     glm::vec3 sun_dir = glm::normalize(glm::vec3(0.3f, 0.8f, 0.5f));
+    uint32_t motion_history = 4; // Frames blended while the scene is animating
 
     explicit Renderer(Context& ctx_);
 
-    void draw_frame(const Scene& scene);
+    void draw_frame(Scene& scene);
     void recreate();
     void reset_frames();
     void update_settings();
@@ -0,0 +1,171 @@
+#include "sample_sequence.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+#include "vulkan/utils.h"
+
+struct SobolPolynomial {
+    uint32_t degree;
+    uint32_t coefficients; // Inner coefficients a, highest first
+    uint32_t initial[3]; // Odd m_1 ... m_degree
+};
+
+// Dimensions 2 to 4 of new-joe-kuo-6.21201, the first dimension is the van der Corput sequence
+constexpr SobolPolynomial SOBOL_POLYNOMIALS[] = {
+    {1, 0, {1}},
+    {2, 1, {1, 3}},
+    {3, 1, {1, 3, 1}},
+};
+
+constexpr uint32_t SOBOL_BITS = 32;
+constexpr float BLUE_NOISE_SIGMA = 1.5f;
+constexpr float BLUE_NOISE_INITIAL_DENSITY = 0.1f;
+
+std::vector<uint32_t> build_sobol_matrices(const uint32_t dimensions) {
+    if (dimensions > std::size(SOBOL_POLYNOMIALS) + 1) {
+        throw std::runtime_error("Too many Sobol dimensions");
+    }
+
+    std::vector<uint32_t> matrices(static_cast<size_t>(dimensions) * SOBOL_BITS);
+
+    for (uint32_t dimension = 0; dimension < dimensions; ++dimension) {
+        uint32_t* v = matrices.data() + static_cast<size_t>(dimension) * SOBOL_BITS;
+
+        if (dimension == 0) {
+            for (uint32_t i = 0; i < SOBOL_BITS; ++i) {
+                v[i] = 1u << (SOBOL_BITS - 1 - i);
+            }
+            continue;
+        }
+
+        const SobolPolynomial& polynomial = SOBOL_POLYNOMIALS[dimension - 1];
+        const uint32_t s = polynomial.degree;
+
+        for (uint32_t i = 0; i < s; ++i) {
+            v[i] = polynomial.initial[i] << (SOBOL_BITS - 1 - i);
+        }
+
+        // v_i = a_1 v_(i-1) ^ ... ^ a_(s-1) v_(i-s+1) ^ v_(i-s) ^ (v_(i-s) >> s)
+        for (uint32_t i = s; i < SOBOL_BITS; ++i) {
+            v[i] = v[i - s] ^ (v[i - s] >> s);
+            for (uint32_t k = 1; k < s; ++k) {
+                if ((polynomial.coefficients >> (s - 1 - k)) & 1) {
+                    v[i] ^= v[i - k];
+                }
+            }
+        }
+    }
+
+    return matrices;
+}
+
+std::vector<float> build_blue_noise(const uint32_t size, const uint32_t seed) {
+    SCOPED_TIMER();
+
+    const size_t count = static_cast<size_t>(size) * size;
+
+    // Toroidal Gaussian, so the tile repeats without seams
+    std::vector<float> kernel(count);
+    for (uint32_t y = 0; y < size; ++y) {
+        for (uint32_t x = 0; x < size; ++x) {
+            const float dx = static_cast<float>(std::min(x, size - x));
+            const float dy = static_cast<float>(std::min(y, size - y));
+            kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+        }
+    }
+
+    std::vector<uint8_t> pattern(count, 0);
+    std::vector<float> energy(count, 0.0f);
+
+    const auto toggle = [&](const size_t pixel) {
+        const float sign = pattern[pixel] ? -1.0f : 1.0f;
+        pattern[pixel] ^= 1;
+
+        const uint32_t px = static_cast<uint32_t>(pixel % size);
+        const uint32_t py = static_cast<uint32_t>(pixel / size);
+        for (uint32_t y = 0; y < size; ++y) {
+            const float* row = kernel.data() + static_cast<size_t>((y + size - py) % size) * size;
+            float* out = energy.data() + static_cast<size_t>(y) * size;
+            for (uint32_t x = 0; x < size; ++x) {
+                out[x] += sign * row[(x + size - px) % size];
+            }
+        }
+    };
+
+    // Densest set pixel and emptiest unset pixel under the kernel
+    const auto tightest_cluster = [&] {
+        size_t best = 0;
+        float best_energy = -1.0f;
+        for (size_t i = 0; i < count; ++i) {
+            if (pattern[i] && energy[i] > best_energy) {
+                best = i;
+                best_energy = energy[i];
+            }
+        }
+        return best;
+    };
+
+    const auto largest_void = [&] {
+        size_t best = 0;
+        float best_energy = std::numeric_limits<float>::max();
+        for (size_t i = 0; i < count; ++i) {
+            if (!pattern[i] && energy[i] < best_energy) {
+                best = i;
+                best_energy = energy[i];
+            }
+        }
+        return best;
+    };
+
+    std::mt19937 rng(seed);
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+
+    const size_t initial_count = std::max<size_t>(1, static_cast<size_t>(count * BLUE_NOISE_INITIAL_DENSITY));
+    for (size_t i = 0; i < initial_count; ++i) {
+        toggle(order[i]);
+    }
+
+    // Move points from clusters into voids until the pattern is evenly spread
+    while (true) {
+        const size_t cluster = tightest_cluster();
+        toggle(cluster);
+        const size_t void_pixel = largest_void();
+        toggle(void_pixel);
+        if (void_pixel == cluster) break;
+    }
+
+    const std::vector<uint8_t> initial_pattern = pattern;
+    const std::vector<float> initial_energy = energy;
+
+    std::vector<uint32_t> ranks(count);
+
+    // Ranks below the initial pattern, removing the tightest clusters first
+    for (size_t rank = initial_count; rank-- > 0;) {
+        const size_t cluster = tightest_cluster();
+        toggle(cluster);
+        ranks[cluster] = static_cast<uint32_t>(rank);
+    }
+
+    // Ranks above it. Past half the tile the unset pixels are the minority, and their tightest cluster is the
+    // largest void of the set ones, so one loop covers both of the remaining phases
+    pattern = initial_pattern;
+    energy = initial_energy;
+    for (size_t rank = initial_count; rank < count; ++rank) {
+        const size_t void_pixel = largest_void();
+        toggle(void_pixel);
+        ranks[void_pixel] = static_cast<uint32_t>(rank);
+    }
+
+    std::vector<float> noise(count);
+    for (size_t i = 0; i < count; ++i) {
+        noise[i] = (static_cast<float>(ranks[i]) + 0.5f) / static_cast<float>(count);
+    }
+    return noise;
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Generator matrices of the first Sobol dimensions, 32 direction numbers per dimension with the most significant bit
+ * first. A sample is the XOR of the direction numbers of the set bits of its index
+ * Source: Joe and Kuo 2008, "Constructing Sobol Sequences with Better Two-Dimensional Projections"
+ * Web: https://web.maths.unsw.edu.au/~fkuo/sobol/
+ */
+std::vector<uint32_t> build_sobol_matrices(uint32_t dimensions);
+
+/**
+ * Tileable blue noise of size x size ranks, normalized to [0, 1). Deterministic for a given seed
+ * Source: Ulichney 1993, "The void-and-cluster method for dither array generation"
+ * Web: https://doi.org/10.1117/12.152707
+ */
+std::vector<float> build_blue_noise(uint32_t size, uint32_t seed);
\ No newline at end of file
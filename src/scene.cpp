@@ -1,48 +1,341 @@
 #include "scene.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+
 #include <spdlog/spdlog.h>
 
 #include "context.h"
+#include "emission.h"
+#include "jobs.h"
+#include "opacity.h"
+#include "window.h"
 #include "vulkan/encoder.h"
+#include "vulkan/utils.h"
 
 // GLM 4x4 column-major to Vulkan 3x4 row-major matrix
 vk::TransformMatrixKHR vk_matrix(const glm::mat4& m) {
-    const glm::mat4 t = glm::transpose(m);
     vk::TransformMatrixKHR out;
-    memcpy(&out, &t, sizeof(float) * 12);
+    for (int row = 0; row < 3; ++row) {
+        for (int col = 0; col < 4; ++col) {
+            out.matrix[row][col] = m[col][row];
+        }
+    }
     return out;
 }
 
+constexpr size_t TLAS_INSTANCE_MIN_BATCH = 4096;
+constexpr size_t MODEL_INSTANCE_MIN_BATCH = 256; // Model instances usually expand to several TLAS instances
+
+bool is_emissive(const Material& material) {
+    return material.emissive_factor.r != 0.0f ||
+           material.emissive_factor.g != 0.0f ||
+           material.emissive_factor.b != 0.0f ||
+           material.emissive_index != UINT32_MAX;
+}
+
+// Primitive, or the triangles of it left after the opacity classification, that becomes a BLAS geometry
+struct GeometrySource {
+    uint32_t primitive; // Index into Mesh::primitives
+    uint32_t vertex_offset;
+    std::span<const uint32_t> indices;
+};
+
+// Emissive geometry of a BLAS, the unit of work of the light extraction
+struct LightSource {
+    uint32_t geometry;
+    glm::vec3 emission;
+    const TextureData* emissive_texture; // Averaged over every triangle when set
+    uint32_t emissive_index; // Bindless index of emissive_texture, sampled per texel on the GPU
+    uint32_t first_light;
+    uint32_t light_count;
+};
+
+constexpr size_t LIGHT_EXTRACTION_MIN_BATCH = 1024;
+
+bool is_procedural(const Blas& blas) {
+    return blas.sbt_offset >= HIT_GROUP_SPHERE;
+}
+
+// Object space bounds of an analytic primitive of the given hit group
+vk::AabbPositionsKHR get_procedural_bounds(const ProceduralPrimitive& primitive, const uint32_t hit_group) {
+    glm::vec3 min;
+    glm::vec3 max;
+    if (hit_group == HIT_GROUP_SPHERE) {
+        min = primitive.p0 - primitive.r0;
+        max = primitive.p0 + primitive.r0;
+    } else if (hit_group == HIT_GROUP_DISC) {
+        // Extent of a disc along each axis shrinks as the axis approaches its normal
+        const glm::vec3 extent = primitive.r0 * glm::sqrt(glm::max(glm::vec3(1.0f) - primitive.p1 * primitive.p1, 0.0f));
+        min = primitive.p0 - extent;
+        max = primitive.p0 + extent;
+    } else {
+        min = glm::min(primitive.p0 - primitive.r0, primitive.p1 - primitive.r1);
+        max = glm::max(primitive.p0 + primitive.r0, primitive.p1 + primitive.r1);
+    }
+    return {min.x, min.y, min.z, max.x, max.y, max.z};
+}
+
+constexpr float LOD_PIXEL_ERROR = 1.0f; // Screen space error a simplified level may show
+
+Scene::~Scene() {
+    if (animation_job.valid()) {
+        animation_job.wait();
+    }
+    if (environment_job.valid()) {
+        environment_job.wait();
+    }
+}
+
 void Scene::add_instance(const std::shared_ptr<Model>& model, const glm::mat4& transform, const Context& ctx) {
-    if (model_cache.contains(model.get())) {
-        model_instances.push_back({
-            .model = model,
-            .transform = transform,
-            .first_blas = model_cache[model.get()]
+    uint32_t animation_state = UINT32_MAX;
+    if (!model->animations.empty()) {
+        const auto it = std::ranges::find_if(animation_states, [&](const AnimationState& state) {
+            return state.model == model.get();
         });
-        return;
+        if (it != animation_states.end()) {
+            animation_state = static_cast<uint32_t>(it - animation_states.begin());
+        } else {
+            animation_state = static_cast<uint32_t>(animation_states.size());
+            animation_states.push_back({.model = model.get(), .animation_index = 0});
+        }
+    }
+
+    const uint32_t first_blas = load_model(model, animation_state, ctx);
+    model_instances.push_back({
+        .model = model,
+        .transform = transform,
+        .first_blas = first_blas,
+        .animation_state = animation_state,
+        .tlas_instance_count = count_tlas_instances(*model, first_blas)
+    });
+}
+
+void Scene::add_light(const Light& light) {
+    if (light.type == LightType::Triangle) {
+        throw std::runtime_error("Triangle lights come from emissive materials, not from Scene::add_light");
+    }
+    analytic_lights.push_back(light);
+}
+
+void Scene::add_scatter(const std::shared_ptr<Model>& model, const ScatterGrid& grid, const Context& ctx) {
+    if (grid.size == 0) return;
+
+    scatters.push_back({
+        .model = model,
+        .first_blas = load_model(model, UINT32_MAX, ctx),
+        .instance_count = grid.size * grid.size * grid.size,
+        .grid = grid
+    });
+}
+
+uint32_t Scene::load_model(const std::shared_ptr<Model>& model, const uint32_t animation_state, const Context& ctx) {
+    if (model_cache.contains(model.get())) {
+        return model_cache[model.get()];
     }
 
     auto first_blas_idx = static_cast<uint32_t>(blases.size());
 
-    for (auto& mesh : model->meshes) {
+    const auto add_blas = [&](const Mesh& mesh, const std::vector<GeometrySource>& sources, const uint32_t hit_group) {
         Blas blas{};
         blas.geometry_offset = static_cast<uint32_t>(geometries.size());
-        blas.geometry_count = static_cast<uint32_t>(mesh.primitives.size());
+        blas.geometry_count = static_cast<uint32_t>(sources.size());
+        blas.sbt_offset = hit_group;
+
+        // Emissive triangles of a BLAS are laid out contiguously after its first light
+
+        for (const auto& source : sources) {
+            const auto& primitive = mesh.primitives[source.primitive];
+
+            // Analytic shapes still emit when hit, but are not sampled as lights
+            if (primitive.shape != PrimitiveShape::Triangles) {
+                geometries.push_back({
+                    .index_offset = static_cast<uint32_t>(procedurals.size()),
+                    .index_count = static_cast<uint32_t>(primitive.procedurals.size()),
+                    .material_index = static_cast<uint32_t>(materials.size()) + primitive.material_index,
+                });
+                procedurals.insert(procedurals.end(), primitive.procedurals.begin(), primitive.procedurals.end());
+                blas.primitives.push_back(source.primitive);
+                continue;
+            }
 
-        for (auto& primitive : mesh.primitives) {
             Geometry geometry{
-                .vertex_offset = static_cast<uint32_t>(vertices.size()),
+                .vertex_offset = source.vertex_offset,
                 .vertex_count = static_cast<uint32_t>(primitive.vertices.size()),
                 .index_offset = static_cast<uint32_t>(indices.size()),
-                .index_count = static_cast<uint32_t>(primitive.indices.size()),
+                .index_count = static_cast<uint32_t>(source.indices.size()),
                 .material_index = static_cast<uint32_t>(materials.size()) + primitive.material_index,
             };
+            if (is_emissive(model->materials[primitive.material_index])) {
+                geometry.light_offset = blas.light_count;
+                blas.light_count += geometry.index_count / 3;
+            }
             geometries.push_back(geometry);
-            vertices.insert(vertices.end(), primitive.vertices.begin(), primitive.vertices.end());
-            indices.insert(indices.end(), primitive.indices.begin(), primitive.indices.end());
+            indices.insert(indices.end(), source.indices.begin(), source.indices.end());
+            blas.primitives.push_back(source.primitive);
         }
         blases.push_back(std::move(blas));
+    };
+
+    // Alpha tested triangles that are fully opaque or fully transparent in texture space need no any-hit shader,
+    // they move to the opaque geometry of the primitive or are dropped
+    std::vector<std::vector<uint32_t>> classified_indices;
+    std::vector<TriangleOpacity> opacities;
+    size_t alpha_triangle_count = 0;
+    size_t opaque_triangle_count = 0;
+    size_t transparent_triangle_count = 0;
+
+    // Opaque and alpha tested triangles of a mesh get separate BLASes, so rays only run the any-hit shader
+    // on the latter. The BLAS of mesh i stays at first_blas + i, the alpha tested ones are appended after them
+    std::vector<std::vector<GeometrySource>> alpha_sources(model->meshes.size());
+    std::vector<std::vector<GeometrySource>> lod_sources(model->meshes.size());
+    // Analytic shapes get one BLAS per shape, an AABB geometry cannot share a BLAS with triangles
+    std::vector<std::array<std::vector<GeometrySource>, 3>> shape_sources(model->meshes.size());
+    std::array<size_t, 3> shape_counts{};
+    for (uint32_t mesh_idx = 0; mesh_idx < model->meshes.size(); ++mesh_idx) {
+        const auto& mesh = model->meshes[mesh_idx];
+
+        std::vector<GeometrySource> opaque_sources;
+        for (uint32_t i = 0; i < mesh.primitives.size(); ++i) {
+            const auto& primitive = mesh.primitives[i];
+            const auto& material = model->materials[primitive.material_index];
+
+            if (primitive.shape != PrimitiveShape::Triangles) {
+                if (primitive.procedurals.empty()) continue;
+                const auto shape = static_cast<size_t>(primitive.shape) - 1;
+                shape_sources[mesh_idx][shape].push_back({.primitive = i});
+                shape_counts[shape] += primitive.procedurals.size();
+                continue;
+            }
+
+            std::span<const uint32_t> opaque_indices;
+            std::span<const uint32_t> alpha_indices;
+            if (material.alpha_mode == AlphaMode::Opaque) {
+                opaque_indices = primitive.indices;
+            } else {
+                const TextureData* albedo = material.albedo_index != UINT32_MAX
+                                                ? &model->textures[material.albedo_index]
+                                                : nullptr;
+                opacities.resize(primitive.indices.size() / 3);
+                classify_triangle_opacity(primitive, material, albedo, opacities);
+
+                std::vector<uint32_t> opaque;
+                std::vector<uint32_t> mixed;
+                for (size_t triangle = 0; triangle < opacities.size(); ++triangle) {
+                    if (opacities[triangle] == TriangleOpacity::Transparent) continue;
+                    auto& dst = opacities[triangle] == TriangleOpacity::Opaque ? opaque : mixed;
+                    dst.insert(dst.end(), primitive.indices.begin() + triangle * 3, primitive.indices.begin() + triangle * 3 + 3);
+                }
+
+                alpha_triangle_count += opacities.size();
+                opaque_triangle_count += opaque.size() / 3;
+                transparent_triangle_count += opacities.size() - (opaque.size() + mixed.size()) / 3;
+
+                // Moving a vector keeps its storage, so the spans stay valid as more lists are added
+                opaque_indices = classified_indices.emplace_back(std::move(opaque));
+                alpha_indices = classified_indices.emplace_back(std::move(mixed));
+            }
+
+            if (opaque_indices.empty() && alpha_indices.empty()) continue;
+
+            // Both parts of a split primitive index the same vertices
+            const auto vertex_offset = static_cast<uint32_t>(vertices.size());
+            vertices.insert(vertices.end(), primitive.vertices.begin(), primitive.vertices.end());
+
+            if (!opaque_indices.empty()) {
+                opaque_sources.push_back({.primitive = i, .vertex_offset = vertex_offset, .indices = opaque_indices});
+            }
+            if (!alpha_indices.empty()) {
+                alpha_sources[mesh_idx].push_back({.primitive = i, .vertex_offset = vertex_offset, .indices = alpha_indices});
+            }
+        }
+
+        // Simplified levels reuse the vertices of the full detail geometries with their own indices
+        const bool lod_eligible = !mesh.lod_errors.empty() && alpha_sources[mesh_idx].empty() &&
+                                  std::ranges::none_of(mesh.primitives, [&](const Primitive& primitive) {
+                                      return is_emissive(model->materials[primitive.material_index]);
+                                  });
+        if (lod_eligible) {
+            lod_sources[mesh_idx] = opaque_sources;
+        }
+
+        if (!opaque_sources.empty()) {
+            add_blas(mesh, opaque_sources, HIT_GROUP_OPAQUE);
+        } else if (!alpha_sources[mesh_idx].empty()) {
+            add_blas(mesh, alpha_sources[mesh_idx], HIT_GROUP_ALPHA_TESTED);
+            alpha_sources[mesh_idx].clear();
+        } else if (const auto shape = std::ranges::find_if(shape_sources[mesh_idx], [](const auto& sources) {
+            return !sources.empty();
+        }); shape != shape_sources[mesh_idx].end()) {
+            add_blas(mesh, *shape, HIT_GROUP_SPHERE + static_cast<uint32_t>(shape - shape_sources[mesh_idx].begin()));
+            shape->clear();
+        } else {
+            add_blas(mesh, opaque_sources, HIT_GROUP_OPAQUE);
+        }
+    }
+
+    // The remaining BLASes of a mesh are chained after its first one, which stays at first_blas + mesh index
+    for (uint32_t mesh_idx = 0; mesh_idx < model->meshes.size(); ++mesh_idx) {
+        uint32_t last_blas = first_blas_idx + mesh_idx;
+        const auto chain_blas = [&](const std::vector<GeometrySource>& sources, const uint32_t hit_group) {
+            if (sources.empty()) return;
+            blases[last_blas].next_blas = static_cast<uint32_t>(blases.size());
+            last_blas = static_cast<uint32_t>(blases.size());
+            add_blas(model->meshes[mesh_idx], sources, hit_group);
+        };
+
+        chain_blas(alpha_sources[mesh_idx], HIT_GROUP_ALPHA_TESTED);
+        for (uint32_t shape = 0; shape < 3; ++shape) {
+            chain_blas(shape_sources[mesh_idx][shape], HIT_GROUP_SPHERE + shape);
+        }
+    }
+
+    for (uint32_t mesh_idx = 0; mesh_idx < model->meshes.size(); ++mesh_idx) {
+        if (lod_sources[mesh_idx].empty()) continue;
+        const auto& mesh = model->meshes[mesh_idx];
+
+        LodChain chain{
+            .blases = {first_blas_idx + mesh_idx},
+            .errors = {0.0f},
+            .center = mesh.bounds_center,
+            .radius = mesh.bounds_radius
+        };
+        for (size_t level = 0; level < mesh.lod_errors.size(); ++level) {
+            std::vector<GeometrySource> sources;
+            for (const auto& source : lod_sources[mesh_idx]) {
+                const auto& lod_indices = mesh.primitives[source.primitive].lod_indices[level];
+                if (lod_indices.empty()) continue;
+                sources.push_back({.primitive = source.primitive, .vertex_offset = source.vertex_offset, .indices = lod_indices});
+            }
+            if (sources.empty()) break;
+
+            chain.blases.push_back(static_cast<uint32_t>(blases.size()));
+            chain.errors.push_back(mesh.lod_errors[level]);
+            add_blas(mesh, sources, HIT_GROUP_OPAQUE);
+        }
+
+        blases[first_blas_idx + mesh_idx].lod_chain = static_cast<uint32_t>(lod_chains.size());
+        lod_chains.push_back(std::move(chain));
+    }
+
+    if (shape_counts[0] + shape_counts[1] + shape_counts[2] > 0) {
+        spdlog::info("Analytic primitives: {} spheres, {} discs, {} curve segments",
+                     shape_counts[0],
+                     shape_counts[1],
+                     shape_counts[2]);
+    }
+
+    if (alpha_triangle_count > 0) {
+        spdlog::info("Alpha tested triangles: {} opaque, {} transparent, {} left to the any-hit shader",
+                     opaque_triangle_count,
+                     transparent_triangle_count,
+                     alpha_triangle_count - opaque_triangle_count - transparent_triangle_count);
+    }
+
+    if (animation_state != UINT32_MAX) {
+        add_deformed_nodes(animation_states[animation_state], first_blas_idx);
     }
 
     std::vector is_srgb_texture(model->textures.size(), false);
@@ -77,15 +370,178 @@ void Scene::add_instance(const std::shared_ptr<Model>& model, const glm::mat4& t
 
         image_views.emplace_back(ctx.get_device(), image, vk::ImageViewType::e2D, vk::ImageAspectFlagBits::eColor, 0, 1);
         images.push_back(std::move(image));
+        texture_data.push_back(&texture);
     }
 
     model_cache[model.get()] = first_blas_idx;
+    return first_blas_idx;
+}
 
-    model_instances.push_back({
-        .model = model,
-        .transform = transform,
-        .first_blas = first_blas_idx
-    });
+void Scene::add_deformed_nodes(AnimationState& state, const uint32_t first_blas) {
+    const Model& model = *state.model;
+
+    for (uint32_t node_idx = 0; node_idx < model.nodes.size(); ++node_idx) {
+        const auto& node = model.nodes[node_idx];
+        const auto& mesh = model.meshes[node.mesh_index];
+
+        const bool skinned = node.skin_index != UINT32_MAX &&
+                             std::ranges::any_of(mesh.primitives, [](const Primitive& primitive) {
+                                 return !primitive.skin.empty();
+                             });
+        const bool morphed = !mesh.weights.empty();
+        if (!skinned && !morphed) continue;
+
+        if (state.node_blases.empty()) {
+            state.node_blases.assign(model.nodes.size(), UINT32_MAX);
+        }
+
+        // Copy of the bind pose geometry that the deformation pass writes to every frame, for each BLAS of the
+        // mesh. The BLASes of a node share its joint and morph weight ranges
+        uint32_t first_joint = UINT32_MAX;
+        if (skinned) {
+            first_joint = static_cast<uint32_t>(joint_matrices.size());
+            joint_matrices.resize(joint_matrices.size() + model.skins[node.skin_index].joints.size(), glm::mat4(1.0f));
+        }
+        const auto first_weight = static_cast<uint32_t>(morph_weights.size());
+        morph_weights.insert(morph_weights.end(), mesh.weights.begin(), mesh.weights.end());
+
+        uint32_t previous_blas = UINT32_MAX;
+        for (uint32_t source_idx = first_blas + node.mesh_index; source_idx != UINT32_MAX;
+             source_idx = blases[source_idx].next_blas) {
+            // Analytic shapes end the chain and are not deformed, the node keeps sharing them
+            if (is_procedural(blases[source_idx])) {
+                if (previous_blas == UINT32_MAX) {
+                    state.node_blases[node_idx] = source_idx;
+                } else {
+                    blases[previous_blas].next_blas = source_idx;
+                }
+                break;
+            }
+
+            Blas blas{};
+            blas.geometry_offset = static_cast<uint32_t>(geometries.size());
+            blas.geometry_count = blases[source_idx].geometry_count;
+            blas.sbt_offset = blases[source_idx].sbt_offset;
+            blas.primitives = blases[source_idx].primitives;
+            blas.deformable = true;
+
+            DeformedNode deformed{
+                .node = node_idx,
+                .blas = static_cast<uint32_t>(blases.size()),
+                .first_deformer = static_cast<uint32_t>(deformers.size()),
+                .deformer_count = blas.geometry_count,
+                .first_joint = first_joint,
+                .first_weight = first_weight,
+            };
+
+            for (uint32_t i = 0; i < blas.geometry_count; ++i) {
+                const auto& primitive = mesh.primitives[blas.primitives[i]];
+
+                Geometry geometry = geometries[blases[source_idx].geometry_offset + i];
+                Deformer deformer{
+                    .src_vertex_offset = geometry.vertex_offset,
+                    .dst_vertex_offset = static_cast<uint32_t>(vertices.size()),
+                    .vertex_count = geometry.vertex_count,
+                };
+
+                geometry.vertex_offset = deformer.dst_vertex_offset;
+                geometries.push_back(geometry);
+                vertices.insert(vertices.end(), primitive.vertices.begin(), primitive.vertices.end());
+
+                if (skinned && !primitive.skin.empty()) {
+                    deformer.skin_offset = static_cast<uint32_t>(skin_vertices.size());
+                    skin_vertices.insert(skin_vertices.end(), primitive.skin.begin(), primitive.skin.end());
+                }
+
+                if (primitive.morph_target_count > 0) {
+                    deformer.morph_offset = static_cast<uint32_t>(morph_deltas.size());
+                    deformer.morph_target_count = primitive.morph_target_count;
+                    morph_deltas.insert(morph_deltas.end(), primitive.morph_deltas.begin(), primitive.morph_deltas.end());
+                }
+
+                deformers.push_back(deformer);
+            }
+
+            if (previous_blas == UINT32_MAX) {
+                state.node_blases[node_idx] = deformed.blas;
+            } else {
+                blases[previous_blas].next_blas = deformed.blas;
+            }
+            previous_blas = deformed.blas;
+
+            state.deformed_nodes.push_back(deformed);
+            blases.push_back(std::move(blas));
+        }
+    }
+}
+
+// Every node gets one TLAS instance per BLAS of its mesh
+uint32_t Scene::count_tlas_instances(const Model& model, const uint32_t first_blas) const {
+    uint32_t count = 0;
+    for (const auto& node : model.nodes) {
+        for (uint32_t blas_idx = first_blas + node.mesh_index; blas_idx != UINT32_MAX; blas_idx = blases[blas_idx].next_blas) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+Scene::BlasGeometry Scene::get_blas_geometry(const Blas& blas,
+                                             const vk::DeviceAddress vertex_address,
+                                             const vk::DeviceAddress index_address,
+                                             const vk::DeviceAddress bounds_address) const {
+    BlasGeometry out{
+        .geometries = std::vector<vk::AccelerationStructureGeometryKHR>(blas.geometry_count),
+        .ranges = std::vector<vk::AccelerationStructureBuildRangeInfoKHR>(blas.geometry_count),
+        .max_counts = std::vector<uint32_t>(blas.geometry_count),
+    };
+
+    for (uint32_t i = 0; i < blas.geometry_count; ++i) {
+        auto& geometry = geometries[blas.geometry_offset + i];
+
+        // Analytic shapes have no any-hit shader, their intersection shader runs for every candidate AABB
+        if (is_procedural(blas)) {
+            out.geometries[i] = vk::AccelerationStructureGeometryKHR{
+                .geometryType = vk::GeometryTypeKHR::eAabbs,
+                .geometry = vk::AccelerationStructureGeometryAabbsDataKHR{
+                    .data = bounds_address + geometry.index_offset * sizeof(vk::AabbPositionsKHR),
+                    .stride = sizeof(vk::AabbPositionsKHR),
+                },
+                .flags = vk::GeometryFlagBitsKHR::eOpaque,
+            };
+
+            out.ranges[i].primitiveCount = geometry.index_count;
+            out.max_counts[i] = geometry.index_count;
+            continue;
+        }
+
+        vk::AccelerationStructureGeometryTrianglesDataKHR triangles_data{
+            .vertexFormat = vk::Format::eR32G32B32Sfloat,
+            .vertexData = vertex_address + geometry.vertex_offset * sizeof(Vertex),
+            .vertexStride = sizeof(Vertex),
+            .maxVertex = geometry.vertex_count - 1,
+            .indexType = vk::IndexType::eUint32,
+            .indexData = index_address + geometry.index_offset * sizeof(uint32_t),
+        };
+
+        // Alpha tested materials keep their opaque triangles in the opaque BLAS of the mesh
+        auto geometry_flags = vk::GeometryFlagBitsKHR::eOpaque;
+
+        if (blas.sbt_offset == HIT_GROUP_ALPHA_TESTED) {
+            geometry_flags = {};
+        }
+
+        out.geometries[i] = vk::AccelerationStructureGeometryKHR{
+            .geometryType = vk::GeometryTypeKHR::eTriangles,
+            .geometry = triangles_data,
+            .flags = geometry_flags,
+        };
+
+        out.ranges[i].primitiveCount = geometry.index_count / 3;
+        out.max_counts[i] = geometry.index_count / 3;
+    }
+
+    return out;
 }
 
 void Scene::build_blases(const Context& ctx) {
@@ -144,6 +600,42 @@ void Scene::build_blases(const Context& ctx) {
     scene_ptrs.materials = material_address;
     scene_ptrs.geometries = geometry_address;
 
+    // Analytic shapes are built from their bounds and intersected against the primitives themselves
+    vk::DeviceAddress bounds_address = 0;
+    if (!procedurals.empty()) {
+        procedural_bounds.resize(procedurals.size());
+        for (const auto& blas : blases) {
+            if (!is_procedural(blas)) continue;
+            for (uint32_t i = 0; i < blas.geometry_count; ++i) {
+                const auto& geometry = geometries[blas.geometry_offset + i];
+                for (uint32_t j = geometry.index_offset; j < geometry.index_offset + geometry.index_count; ++j) {
+                    procedural_bounds[j] = get_procedural_bounds(procedurals[j], blas.sbt_offset);
+                }
+            }
+        }
+
+        procedural_buffer = BufferBuilder()
+                            .size(sizeof(ProceduralPrimitive) * procedurals.size())
+                            .usage(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress)
+                            .allocation_flags(
+                                VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                            .build(ctx.get_allocator());
+
+        procedural_bounds_buffer = BufferBuilder()
+                                   .size(sizeof(vk::AabbPositionsKHR) * procedural_bounds.size())
+                                   .usage(vk::BufferUsageFlagBits::eShaderDeviceAddress |
+                                          vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR)
+                                   .allocation_flags(
+                                       VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                                   .build(ctx.get_allocator());
+
+        memcpy(procedural_buffer.mapped_ptr(), procedurals.data(), procedurals.size() * sizeof(ProceduralPrimitive));
+        memcpy(procedural_bounds_buffer.mapped_ptr(), procedural_bounds.data(), procedural_bounds.size() * sizeof(vk::AabbPositionsKHR));
+
+        scene_ptrs.procedurals = procedural_buffer.get_device_address(ctx.get_device());
+        bounds_address = procedural_bounds_buffer.get_device_address(ctx.get_device());
+    }
+
     auto as_props = ctx.get_adapter().get().getProperties2<
         vk::PhysicalDeviceProperties2,
         vk::PhysicalDeviceAccelerationStructurePropertiesKHR
@@ -153,42 +645,70 @@ void Scene::build_blases(const Context& ctx) {
 
     std::vector<Buffer> scratch_buffers;
 
-    for (auto& blas : blases) {
-        std::vector<vk::AccelerationStructureGeometryKHR> as_geometries(blas.geometry_count);
-        std::vector<vk::AccelerationStructureBuildRangeInfoKHR> as_ranges(blas.geometry_count);
-        std::vector<uint32_t> max_counts(blas.geometry_count);
+    vk::DeviceSize update_scratch_size = 0;
 
-        for (uint32_t i = 0; i < blas.geometry_count; ++i) {
-            auto& geometry = geometries[blas.geometry_offset + i];
-
-            vk::AccelerationStructureGeometryTrianglesDataKHR triangles_data{
-                .vertexFormat = vk::Format::eR32G32B32Sfloat,
-                .vertexData = vertex_address + geometry.vertex_offset * sizeof(Vertex),
-                .vertexStride = sizeof(Vertex),
-                .maxVertex = geometry.vertex_count - 1,
-                .indexType = vk::IndexType::eUint32,
-                .indexData = index_address + geometry.index_offset * sizeof(uint32_t),
-            };
+    // Static BLASes are deserialized from the disk cache when their build input has been built on this device
+    // and driver before, deformed ones are refit every frame and always built
+    const AccelerationStructureCache as_cache(ctx.get_adapter(),
+                                              utils::get_exec_path().parent_path().parent_path() / "cache" / "as");
+    std::vector<uint64_t> blas_keys(blases.size(), 0);
+    JobSystem::parallel_for(blases.size(), 1, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            if (!blases[i].deformable) blas_keys[i] = hash_blas_input(blases[i]);
+        }
+    });
 
-            auto geometry_flags = vk::GeometryFlagBitsKHR::eOpaque;
+    std::vector<Buffer> serialized_buffers;
+    std::vector<uint32_t> uncached_blases;
+    std::vector<uint32_t> host_blases;
+
+    for (uint32_t blas_idx = 0; blas_idx < blases.size(); ++blas_idx) {
+        auto& blas = blases[blas_idx];
+
+        if (!blas.deformable) {
+            const auto serialized = as_cache.load(ctx.get_device(), blas_keys[blas_idx]);
+            if (!serialized.empty()) {
+                blas.as = AccelerationStructure(ctx.get_device(),
+                                                ctx.get_allocator(),
+                                                {.accelerationStructureSize = AccelerationStructureCache::get_deserialized_size(serialized)},
+                                                vk::AccelerationStructureTypeKHR::eBottomLevel);
+
+                auto& serialized_buffer = serialized_buffers.emplace_back(BufferBuilder()
+                                                                          .size(serialized.size())
+                                                                          .usage(vk::BufferUsageFlagBits::eShaderDeviceAddress)
+                                                                          .allocation_flags(
+                                                                              VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                                                                              VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                                                                          .min_alignment(AccelerationStructureCache::SERIALIZED_ALIGNMENT)
+                                                                          .build(ctx.get_allocator()));
+                memcpy(serialized_buffer.mapped_ptr(), serialized.data(), serialized.size());
+
+                single_time_encoder.get_cmd().copyMemoryToAccelerationStructureKHR(vk::CopyMemoryToAccelerationStructureInfoKHR{
+                    .src = {.deviceAddress = serialized_buffer.get_device_address(ctx.get_device())},
+                    .dst = blas.as.get_handle(),
+                    .mode = vk::CopyAccelerationStructureModeKHR::eDeserialize,
+                });
+                continue;
+            }
+            uncached_blases.push_back(blas_idx);
 
-            if (materials[geometry.material_index].alpha_mode != AlphaMode::Opaque) {
-                geometry_flags = {};
+            if (ctx.get_device().uses_host_acceleration_structure_builds()) {
+                host_blases.push_back(blas_idx);
+                continue;
             }
+        }
 
-            as_geometries[i] = vk::AccelerationStructureGeometryKHR{
-                .geometryType = vk::GeometryTypeKHR::eTriangles,
-                .geometry = triangles_data,
-                .flags = geometry_flags,
-            };
+        auto [as_geometries, as_ranges, max_counts] = get_blas_geometry(blas, vertex_address, index_address, bounds_address);
 
-            as_ranges[i].primitiveCount = geometry.index_count / 3;
-            max_counts[i] = geometry.index_count / 3;
+        // Deformed meshes are refit every animated frame instead of rebuilt
+        auto build_flags = vk::BuildAccelerationStructureFlagsKHR(vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace);
+        if (blas.deformable) {
+            build_flags |= vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
         }
 
         vk::AccelerationStructureBuildGeometryInfoKHR build_info{
             .type = vk::AccelerationStructureTypeKHR::eBottomLevel,
-            .flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace,
+            .flags = build_flags,
             .mode = vk::BuildAccelerationStructureModeKHR::eBuild,
             .geometryCount = static_cast<uint32_t>(as_geometries.size()),
             .pGeometries = as_geometries.data(),
@@ -204,6 +724,13 @@ void Scene::build_blases(const Context& ctx) {
                                         build_sizes,
                                         vk::AccelerationStructureTypeKHR::eBottomLevel);
 
+        // Every deformable BLAS gets its own scratch range so all refits can be recorded in one call
+        if (blas.deformable) {
+            const vk::DeviceSize alignment = as_props.minAccelerationStructureScratchOffsetAlignment;
+            blas.update_scratch_offset = update_scratch_size;
+            update_scratch_size += (build_sizes.updateScratchSize + alignment - 1) / alignment * alignment;
+        }
+
         auto& scratch_buffer = scratch_buffers.emplace_back(BufferBuilder()
                                                             .size(build_sizes.buildScratchSize)
                                                             .usage(
@@ -233,64 +760,363 @@ void Scene::build_blases(const Context& ctx) {
 
     single_time_encoder.get_cmd().pipelineBarrier2(dependency_info);
     single_time_encoder.submit(ctx.get_device());
+
+    spdlog::info("{} of {} static BLASes loaded from the acceleration structure cache",
+                 serialized_buffers.size(), serialized_buffers.size() + uncached_blases.size());
+
+    build_blases_on_host(ctx, host_blases);
+    write_blas_cache(ctx, as_cache, uncached_blases, blas_keys);
+
+    if (update_scratch_size > 0) {
+        blas_update_scratch_buffer = BufferBuilder()
+                                     .size(update_scratch_size)
+                                     .usage(
+                                         vk::BufferUsageFlagBits::eStorageBuffer |
+                                         vk::BufferUsageFlagBits::eShaderDeviceAddress)
+                                     .min_alignment(as_props.minAccelerationStructureScratchOffsetAlignment)
+                                     .build(ctx.get_allocator());
+    }
+
+    if (!skin_vertices.empty()) {
+        skin_vertex_buffer = BufferBuilder()
+                             .size(sizeof(SkinVertex) * skin_vertices.size())
+                             .usage(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress)
+                             .allocation_flags(
+                                 VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                             .build(ctx.get_allocator());
+        memcpy(skin_vertex_buffer.mapped_ptr(), skin_vertices.data(), skin_vertices.size() * sizeof(SkinVertex));
+    }
+
+    if (!morph_deltas.empty()) {
+        morph_delta_buffer = BufferBuilder()
+                             .size(sizeof(MorphDelta) * morph_deltas.size())
+                             .usage(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress)
+                             .allocation_flags(
+                                 VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                             .build(ctx.get_allocator());
+        memcpy(morph_delta_buffer.mapped_ptr(), morph_deltas.data(), morph_deltas.size() * sizeof(MorphDelta));
+    }
+}
+
+// Static BLASes built by the CPU from the host copies of the geometry, one deferred operation joined by the job threads
+void Scene::build_blases_on_host(const Context& ctx, const std::span<const uint32_t> blas_indices) {
+    if (blas_indices.empty()) return;
+
+    SCOPED_TIMER_NAMED("{} BLASes", blas_indices.size());
+
+    const auto& device = ctx.get_device().get();
+
+    std::vector<BlasGeometry> blas_geometries;
+    std::vector<std::vector<std::byte>> scratch_memory(blas_indices.size());
+    std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> build_infos;
+    std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> range_infos;
+    blas_geometries.reserve(blas_indices.size());
+
+    for (size_t i = 0; i < blas_indices.size(); ++i) {
+        auto& blas = blases[blas_indices[i]];
+
+        auto& blas_geometry = blas_geometries.emplace_back(get_blas_geometry(blas, 0, 0, 0));
+        for (uint32_t j = 0; j < blas.geometry_count; ++j) {
+            const auto& geometry = geometries[blas.geometry_offset + j];
+            if (is_procedural(blas)) {
+                blas_geometry.geometries[j].geometry.aabbs.data.hostAddress = procedural_bounds.data() + geometry.index_offset;
+                continue;
+            }
+            auto& triangles = blas_geometry.geometries[j].geometry.triangles;
+            triangles.vertexData.hostAddress = vertices.data() + geometry.vertex_offset;
+            triangles.indexData.hostAddress = indices.data() + geometry.index_offset;
+        }
+
+        vk::AccelerationStructureBuildGeometryInfoKHR build_info{
+            .type = vk::AccelerationStructureTypeKHR::eBottomLevel,
+            .flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace,
+            .mode = vk::BuildAccelerationStructureModeKHR::eBuild,
+            .geometryCount = static_cast<uint32_t>(blas_geometry.geometries.size()),
+            .pGeometries = blas_geometry.geometries.data(),
+        };
+
+        const auto build_sizes = device.getAccelerationStructureBuildSizesKHR(
+            vk::AccelerationStructureBuildTypeKHR::eHost,
+            build_info,
+            blas_geometry.max_counts);
+
+        blas.as = AccelerationStructure(ctx.get_device(),
+                                        ctx.get_allocator(),
+                                        build_sizes,
+                                        vk::AccelerationStructureTypeKHR::eBottomLevel,
+                                        true);
+
+        scratch_memory[i].resize(build_sizes.buildScratchSize);
+        build_info.dstAccelerationStructure = blas.as.get_handle();
+        build_info.scratchData.hostAddress = scratch_memory[i].data();
+
+        build_infos.push_back(build_info);
+        range_infos.push_back(blas_geometry.ranges.data());
+    }
+
+    const vk::raii::DeferredOperationKHR operation = device.createDeferredOperationKHR();
+    vk::Result result = device.buildAccelerationStructuresKHR(*operation, build_infos, range_infos);
+
+    // Every job thread joins until the driver has no work left to hand out
+    if (result == vk::Result::eOperationDeferredKHR) {
+        const uint32_t concurrency = std::clamp(operation.getMaxConcurrency(), 1u, JobSystem::get_thread_count());
+        JobSystem::parallel_for(concurrency, 1, [&](const size_t begin, const size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                while (operation.join() == vk::Result::eThreadIdleKHR) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        result = operation.getResult();
+    }
+
+    if (result != vk::Result::eSuccess && result != vk::Result::eOperationNotDeferredKHR) {
+        throw std::runtime_error("Failed to build BLASes on the host: " + vk::to_string(result));
+    }
+}
+
+// Everything the driver sees when building the BLAS, so equal keys mean interchangeable acceleration structures
+uint64_t Scene::hash_blas_input(const Blas& blas) const {
+    uint64_t hash = fnv1a(std::as_bytes(std::span(&blas.sbt_offset, 1)));
+    for (uint32_t i = 0; i < blas.geometry_count; ++i) {
+        const auto& geometry = geometries[blas.geometry_offset + i];
+        if (is_procedural(blas)) {
+            hash = fnv1a(std::as_bytes(std::span(procedural_bounds.data() + geometry.index_offset, geometry.index_count)), hash);
+            continue;
+        }
+        hash = fnv1a(std::as_bytes(std::span(&geometry.vertex_count, 1)), hash);
+        hash = fnv1a(std::as_bytes(std::span(&geometry.index_count, 1)), hash);
+        for (uint32_t v = 0; v < geometry.vertex_count; ++v) {
+            hash = fnv1a(std::as_bytes(std::span(&vertices[geometry.vertex_offset + v].position, 1)), hash);
+        }
+        hash = fnv1a(std::as_bytes(std::span(indices.data() + geometry.index_offset, geometry.index_count)), hash);
+    }
+    return hash;
+}
+
+void Scene::write_blas_cache(const Context& ctx,
+                             const AccelerationStructureCache& cache,
+                             const std::span<const uint32_t> blas_indices,
+                             const std::span<const uint64_t> keys) const {
+    if (blas_indices.empty()) return;
+
+    SCOPED_TIMER();
+
+    const auto query_count = static_cast<uint32_t>(blas_indices.size());
+    const vk::raii::QueryPool query_pool = ctx.get_device().get().createQueryPool(vk::QueryPoolCreateInfo{
+        .queryType = vk::QueryType::eAccelerationStructureSerializationSizeKHR,
+        .queryCount = query_count,
+    });
+
+    std::vector<vk::AccelerationStructureKHR> handles;
+    handles.reserve(blas_indices.size());
+    for (const uint32_t blas_idx : blas_indices) {
+        handles.push_back(*blases[blas_idx].as.get_handle());
+    }
+
+    const auto size_encoder = SingleTimeEncoder(ctx.get_device());
+    size_encoder.get_cmd().resetQueryPool(query_pool, 0, query_count);
+    size_encoder.get_cmd().writeAccelerationStructuresPropertiesKHR(
+        handles, vk::QueryType::eAccelerationStructureSerializationSizeKHR, query_pool, 0);
+    size_encoder.submit(ctx.get_device());
+
+    const auto [result, sizes] = query_pool.getResults<vk::DeviceSize>(
+        0, query_count, query_count * sizeof(vk::DeviceSize), sizeof(vk::DeviceSize),
+        vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+    if (result != vk::Result::eSuccess) {
+        spdlog::warn("Failed to query BLAS serialization sizes, the acceleration structure cache is not updated");
+        return;
+    }
+
+    const auto copy_encoder = SingleTimeEncoder(ctx.get_device());
+    std::vector<Buffer> serialized_buffers;
+    serialized_buffers.reserve(blas_indices.size());
+    for (size_t i = 0; i < blas_indices.size(); ++i) {
+        const auto& buffer = serialized_buffers.emplace_back(BufferBuilder()
+                                                             .size(sizes[i])
+                                                             .usage(vk::BufferUsageFlagBits::eShaderDeviceAddress)
+                                                             .allocation_flags(VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                                                                               VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                                                             .min_alignment(AccelerationStructureCache::SERIALIZED_ALIGNMENT)
+                                                             .build(ctx.get_allocator()));
+
+        copy_encoder.get_cmd().copyAccelerationStructureToMemoryKHR(vk::CopyAccelerationStructureToMemoryInfoKHR{
+            .src = handles[i],
+            .dst = {.deviceAddress = buffer.get_device_address(ctx.get_device())},
+            .mode = vk::CopyAccelerationStructureModeKHR::eSerialize,
+        });
+    }
+
+    vk::MemoryBarrier2 readback_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+        .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eHost,
+        .dstAccessMask = vk::AccessFlagBits2::eHostRead,
+    };
+
+    copy_encoder.get_cmd().pipelineBarrier2(vk::DependencyInfo{
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &readback_barrier,
+    });
+    copy_encoder.submit(ctx.get_device());
+
+    for (size_t i = 0; i < blas_indices.size(); ++i) {
+        const auto& buffer = serialized_buffers[i];
+        vmaInvalidateAllocation(ctx.get_allocator().get(), buffer.get_allocation(), 0, VK_WHOLE_SIZE);
+        cache.store(keys[blas_indices[i]], std::span(buffer.mapped_ptr<const std::byte>(), sizes[i]));
+    }
 }
 
 void Scene::build_tlas(const Context& ctx) {
     spdlog::info("Building tlas...");
 
-    std::vector<vk::AccelerationStructureInstanceKHR> tlas_instances;
-
-    for (const auto& model_instance : model_instances) {
-        for (const auto& node : model_instance.model->nodes) {
-            glm::mat4 final_transform = model_instance.transform * node.transform;
-            const uint32_t blas_idx = model_instance.first_blas + node.mesh_index;
-            const auto& blas = blases[blas_idx];
+    // Instance ranges of every model instance, then a parallel fill of the arrays
+    uint32_t tlas_instance_count = 0;
+    for (auto& model_instance : model_instances) {
+        model_instance.first_tlas_instance = tlas_instance_count;
+        tlas_instance_count += model_instance.tlas_instance_count;
+    }
 
-            uint32_t sbt_offset = 0;
+    tlas_instances.transforms.resize(tlas_instance_count);
+    tlas_instances.blases.resize(tlas_instance_count);
+    tlas_instances.lods.assign(tlas_instance_count, 0);
+
+    JobSystem::parallel_for(model_instances.size(), MODEL_INSTANCE_MIN_BATCH, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const auto& model_instance = model_instances[i];
+            const auto& nodes = model_instance.model->nodes;
+            const std::vector<uint32_t>* node_blases = model_instance.animation_state != UINT32_MAX
+                                                           ? &animation_states[model_instance.animation_state].node_blases
+                                                           : nullptr;
+
+            uint32_t tlas_idx = model_instance.first_tlas_instance;
+            for (uint32_t node_idx = 0; node_idx < nodes.size(); ++node_idx) {
+                const auto& node = nodes[node_idx];
+                uint32_t blas_idx = model_instance.first_blas + node.mesh_index;
+                if (node_blases && !node_blases->empty() && (*node_blases)[node_idx] != UINT32_MAX) {
+                    blas_idx = (*node_blases)[node_idx];
+                }
 
-            for (uint32_t i = 0; i < blas.geometry_count; ++i) {
-                uint32_t geometry_idx = blas.geometry_offset + i;
-                const auto& material = materials[geometries[geometry_idx].material_index];
+                // The alpha tested BLAS of the mesh directly follows with the same transform
+                const glm::mat4 transform = model_instance.transform * node.transform;
+                for (; blas_idx != UINT32_MAX; blas_idx = blases[blas_idx].next_blas) {
+                    tlas_instances.transforms[tlas_idx] = transform;
+                    tlas_instances.blases[tlas_idx] = blas_idx;
+                    ++tlas_idx;
+                }
+            }
+        }
+    });
 
-                if (material.alpha_mode != AlphaMode::Opaque) {
-                    sbt_offset = 1;
-                    break;
+    // Scattered instances follow the CPU written ones, one TLAS instance per node BLAS of their model
+    scatter_nodes.clear();
+    scatter_lods.clear();
+    generated_instance_count = 0;
+    for (auto& scatter : scatters) {
+        scatter.first_node = static_cast<uint32_t>(scatter_nodes.size());
+        for (const auto& node : scatter.model->nodes) {
+            for (uint32_t blas_idx = scatter.first_blas + node.mesh_index; blas_idx != UINT32_MAX;
+                 blas_idx = blases[blas_idx].next_blas) {
+                const auto& blas = blases[blas_idx];
+                ScatterNode scatter_node{
+                    .transform = node.transform,
+                    .blas_address = blas.as.get_device_address(),
+                    .custom_index = blas.geometry_offset,
+                    .sbt_offset = blas.sbt_offset
+                };
+
+                // Every level of the chain goes to the GPU, which picks one per instance from the camera
+                if (blas.lod_chain != UINT32_MAX) {
+                    const auto& chain = lod_chains[blas.lod_chain];
+                    scatter_node.first_lod = static_cast<uint32_t>(scatter_lods.size());
+                    scatter_node.lod_count = static_cast<uint32_t>(chain.blases.size());
+                    scatter_node.lod_center = chain.center;
+                    scatter_node.lod_radius = chain.radius;
+                    for (size_t level = 0; level < chain.blases.size(); ++level) {
+                        const auto& lod_blas = blases[chain.blases[level]];
+                        scatter_lods.push_back({
+                            .blas_address = lod_blas.as.get_device_address(),
+                            .custom_index = lod_blas.geometry_offset,
+                            .error = chain.errors[level]
+                        });
+                    }
                 }
+                scatter_nodes.push_back(scatter_node);
             }
+        }
+        scatter.node_count = static_cast<uint32_t>(scatter_nodes.size()) - scatter.first_node;
+        generated_instance_count += scatter.instance_count * scatter.node_count;
+    }
 
-            vk::AccelerationStructureInstanceKHR tlas_instance{
-                .transform = vk_matrix(final_transform),
-                .instanceCustomIndex = blas.geometry_offset,
-                .mask = 0xFF,
-                .instanceShaderBindingTableRecordOffset = sbt_offset,
-                .flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR,
-                .accelerationStructureReference = blas.as.get_device_address()
+    if (!scatter_nodes.empty()) {
+        scatter_node_buffer = BufferBuilder()
+                              .size(scatter_nodes.size() * sizeof(ScatterNode))
+                              .usage(vk::BufferUsageFlagBits::eShaderDeviceAddress)
+                              .allocation_flags(VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                                                VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                              .build(ctx.get_allocator());
+
+        memcpy(scatter_node_buffer.mapped_ptr(), scatter_nodes.data(), scatter_nodes.size() * sizeof(ScatterNode));
+
+        if (!scatter_lods.empty()) {
+            scatter_lod_buffer = BufferBuilder()
+                                 .size(scatter_lods.size() * sizeof(ScatterLod))
+                                 .usage(vk::BufferUsageFlagBits::eShaderDeviceAddress)
+                                 .allocation_flags(VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                                                   VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                                 .build(ctx.get_allocator());
+
+            memcpy(scatter_lod_buffer.mapped_ptr(), scatter_lods.data(), scatter_lods.size() * sizeof(ScatterLod));
+        }
+
+        if (!instance_pipeline) {
+            constexpr vk::PushConstantRange push_constant_range{
+                .stageFlags = vk::ShaderStageFlagBits::eCompute,
+                .offset = 0,
+                .size = sizeof(InstanceGenPushData)
             };
-            tlas_instances.push_back(tlas_instance);
+
+            const auto spirv_dir = utils::get_exec_path().parent_path().parent_path() / "src" / "shaders" / "spirv";
+
+            instance_pipeline = std::make_unique<ComputePipeline>(
+                ComputePipelineBuilder()
+                .stage((spirv_dir / "instances.spv").string())
+                .push_constant_range(push_constant_range)
+                .build(ctx.get_device()));
         }
     }
 
-    if (tlas_instances.empty()) return;
+    tlas_instance_count += generated_instance_count;
+    if (tlas_instance_count == 0) return;
+
+    spdlog::info("TLAS has {} instances, {} of them generated on the GPU", tlas_instance_count, generated_instance_count);
 
     auto as_props = ctx.get_adapter().get().getProperties2<
         vk::PhysicalDeviceProperties2,
         vk::PhysicalDeviceAccelerationStructurePropertiesKHR
     >().get<vk::PhysicalDeviceAccelerationStructurePropertiesKHR>();
 
-    auto instance_buffer = BufferBuilder()
-                           .size(tlas_instances.size() * sizeof(vk::AccelerationStructureInstanceKHR))
+    // Device local, the build and every refit read it, only the CPU written prefix goes through staging
+    tlas_instance_buffer = BufferBuilder()
+                           .size(tlas_instance_count * sizeof(vk::AccelerationStructureInstanceKHR))
                            .usage(
+                               vk::BufferUsageFlagBits::eStorageBuffer |
                                vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR |
-                               vk::BufferUsageFlagBits::eShaderDeviceAddress)
-                           .allocation_flags(VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
-                                             VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                               vk::BufferUsageFlagBits::eShaderDeviceAddress |
+                               vk::BufferUsageFlagBits::eTransferDst)
                            .build(ctx.get_allocator());
 
-    memcpy(instance_buffer.mapped_ptr(),
-           tlas_instances.data(),
-           tlas_instances.size() * sizeof(vk::AccelerationStructureInstanceKHR));
+    auto instance_staging_buffer = BufferBuilder()
+                                   .size(std::max<vk::DeviceSize>(tlas_instances.transforms.size() *
+                                                                  sizeof(vk::AccelerationStructureInstanceKHR), 16))
+                                   .usage(vk::BufferUsageFlagBits::eTransferSrc)
+                                   .allocation_flags(VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                                                     VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                                   .build(ctx.get_allocator());
+
+    write_tlas_instances(static_cast<vk::AccelerationStructureInstanceKHR*>(instance_staging_buffer.mapped_ptr()));
 
-    auto instance_device_address = instance_buffer.get_device_address(ctx.get_device());
+    auto instance_device_address = tlas_instance_buffer.get_device_address(ctx.get_device());
 
     vk::AccelerationStructureGeometryInstancesDataKHR instances_data{
         .arrayOfPointers = vk::False,
@@ -303,16 +1129,22 @@ void Scene::build_tlas(const Context& ctx) {
         .flags = vk::GeometryFlagBitsKHR::eOpaque,
     };
 
+    // Animated scenes and scattered LODs refit the TLAS every frame instead of rebuilding it
+    tlas_build_flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
+    if (has_animations() || !scatter_lods.empty()) {
+        tlas_build_flags |= vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+    }
+
     vk::AccelerationStructureBuildGeometryInfoKHR geometry_info{
         .type = vk::AccelerationStructureTypeKHR::eTopLevel,
-        .flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace,
+        .flags = tlas_build_flags,
         .mode = vk::BuildAccelerationStructureModeKHR::eBuild,
         .geometryCount = 1,
         .pGeometries = &geometry,
     };
 
     vk::AccelerationStructureBuildRangeInfoKHR range_info{
-        .primitiveCount = static_cast<uint32_t>(tlas_instances.size()),
+        .primitiveCount = tlas_instance_count,
         .primitiveOffset = 0,
         .firstVertex = 0,
         .transformOffset = 0,
@@ -331,8 +1163,8 @@ void Scene::build_tlas(const Context& ctx) {
         sizes_info,
         vk::AccelerationStructureTypeKHR::eTopLevel);
 
-    auto scratch_buffer = BufferBuilder()
-                          .size(sizes_info.buildScratchSize)
+    tlas_scratch_buffer = BufferBuilder()
+                          .size(std::max(sizes_info.buildScratchSize, sizes_info.updateScratchSize))
                           .usage(
                               vk::BufferUsageFlagBits::eStorageBuffer |
                               vk::BufferUsageFlagBits::eShaderDeviceAddress)
@@ -340,10 +1172,12 @@ void Scene::build_tlas(const Context& ctx) {
                           .build(ctx.get_allocator());
 
     geometry_info.dstAccelerationStructure = tlas.get_handle();
-    geometry_info.scratchData = scratch_buffer.get_device_address(ctx.get_device());
+    geometry_info.scratchData = tlas_scratch_buffer.get_device_address(ctx.get_device());
 
     auto single_time_encoder = SingleTimeEncoder(ctx.get_device());
 
+    record_instance_upload(single_time_encoder.get_cmd(), instance_staging_buffer);
+    record_instance_generation(ctx, single_time_encoder.get_cmd(), instance_device_address, 0);
     single_time_encoder.get_cmd().buildAccelerationStructuresKHR({geometry_info}, {&range_info});
 
     vk::MemoryBarrier2 build_barrier{
@@ -362,63 +1196,892 @@ void Scene::build_tlas(const Context& ctx) {
     single_time_encoder.submit(ctx.get_device());
 }
 
+// Instance records go straight into mapped memory, sequential writes keep write-combined memory fast
+void Scene::write_tlas_instances(vk::AccelerationStructureInstanceKHR* dst) const {
+    JobSystem::parallel_for(tlas_instances.transforms.size(), TLAS_INSTANCE_MIN_BATCH, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t blas_idx = tlas_instances.blases[i];
+            if (blases[blas_idx].lod_chain != UINT32_MAX) {
+                blas_idx = lod_chains[blases[blas_idx].lod_chain].blases[tlas_instances.lods[i]];
+            }
+            const auto& blas = blases[blas_idx];
+            // Fully opaque BLASes skip any-hit checks entirely
+            const VkGeometryInstanceFlagsKHR opaque_flags = blas.sbt_offset != HIT_GROUP_ALPHA_TESTED
+                                                               ? VK_GEOMETRY_INSTANCE_FORCE_OPAQUE_BIT_KHR
+                                                               : 0;
+            dst[i] = vk::AccelerationStructureInstanceKHR{
+                .transform = vk_matrix(tlas_instances.transforms[i]),
+                .instanceCustomIndex = blas.geometry_offset,
+                .mask = 0xFF,
+                .instanceShaderBindingTableRecordOffset = blas.sbt_offset,
+                .flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR | opaque_flags,
+                .accelerationStructureReference = blas.as.get_device_address()
+            };
+        }
+    });
+}
+
+void Scene::record_instance_upload(const vk::raii::CommandBuffer& cmd, const Buffer& staging_buffer) const {
+    if (tlas_instances.transforms.empty()) return;
+
+    // The previous TLAS build or refit may still be reading the instances, the generated ones included
+    vk::MemoryBarrier2 pre_copy_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+        .srcAccessMask = vk::AccessFlagBits2::eShaderRead,
+        .dstStageMask = vk::PipelineStageFlagBits2::eCopy | vk::PipelineStageFlagBits2::eComputeShader,
+        .dstAccessMask = vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eShaderWrite,
+    };
+
+    cmd.pipelineBarrier2(vk::DependencyInfo{
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &pre_copy_barrier,
+    });
+
+    cmd.copyBuffer(staging_buffer.get(), tlas_instance_buffer.get(),
+                   vk::BufferCopy{.size = tlas_instances.transforms.size() * sizeof(vk::AccelerationStructureInstanceKHR)});
+
+    vk::MemoryBarrier2 copy_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eCopy,
+        .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderRead,
+    };
+
+    cmd.pipelineBarrier2(vk::DependencyInfo{
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &copy_barrier,
+    });
+}
+
+void Scene::record_instance_generation(const Context& ctx,
+                                       const vk::raii::CommandBuffer& cmd,
+                                       const vk::DeviceAddress instance_address,
+                                       const vk::DeviceAddress lod_changed_address) const {
+    if (scatters.empty()) return;
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, instance_pipeline->get());
+
+    // One thread per scattered instance, large scatters are split to stay within the dispatch size limit
+    constexpr uint32_t group_size = 64;
+    constexpr uint32_t max_dispatch_instances = 65535 * group_size;
+
+    const auto node_address = scatter_node_buffer.get_device_address(ctx.get_device());
+    const vk::DeviceAddress lod_address = scatter_lods.empty()
+                                              ? 0
+                                              : scatter_lod_buffer.get_device_address(ctx.get_device());
+    const float lod_max_error = get_lod_max_error();
+    vk::DeviceAddress dst_address = instance_address + tlas_instances.transforms.size() * sizeof(TlasInstance);
+
+    for (const auto& scatter : scatters) {
+        const uint32_t node_count = scatter.node_count;
+
+        for (uint32_t first = 0; first < scatter.instance_count; first += max_dispatch_instances) {
+            const uint32_t count = std::min(scatter.instance_count - first, max_dispatch_instances);
+
+            InstanceGenPushData push_data{
+                .dst_instances = dst_address,
+                .nodes = node_address + scatter.first_node * sizeof(ScatterNode),
+                .lods = lod_address,
+                .lod_changed = lod_changed_address,
+                .grid_origin = scatter.grid.origin,
+                .grid_spacing = scatter.grid.spacing,
+                .grid_size = scatter.grid.size,
+                .seed = scatter.grid.seed,
+                .node_count = node_count,
+                .first_instance = first,
+                .instance_count = count,
+                .camera_pos = camera.get_pos(),
+                .lod_max_error = lod_max_error,
+            };
+
+            cmd.pushConstants2(vk::PushConstantsInfo{
+                .layout = instance_pipeline->get_layout(),
+                .stageFlags = vk::ShaderStageFlagBits::eCompute,
+                .offset = 0,
+                .size = sizeof(InstanceGenPushData),
+                .pValues = &push_data,
+            });
+            cmd.dispatch((count + group_size - 1) / group_size, 1, 1);
+        }
+
+        dst_address += static_cast<vk::DeviceSize>(scatter.instance_count) * node_count * sizeof(TlasInstance);
+    }
+
+    // The level change flag is read back by the host once the frame's fence has signalled
+    vk::MemoryBarrier2 generation_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+        .srcAccessMask = vk::AccessFlagBits2::eShaderWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR | vk::PipelineStageFlagBits2::eHost,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eHostRead,
+    };
+
+    cmd.pipelineBarrier2(vk::DependencyInfo{
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &generation_barrier,
+    });
+}
+
+void Scene::update(const float delta) {
+    update_lods();
+
+    if (!is_animating()) return;
+
+    // The job started last frame has sampled the poses for the current animation time
+    if (animation_job.valid()) {
+        animation_job.get();
+        apply_poses();
+    }
+
+    animation_time += delta * animation_speed;
+
+    animation_job = JobSystem::submit([this, time = animation_time] {
+        for (auto& state : animation_states) {
+            const auto& animation = state.model->animations[state.animation_index];
+            const float local_time = animation.duration > 0.0f ? std::fmod(time, animation.duration) : 0.0f;
+            state.model->sample_pose(state.animation_index, local_time, state.pose);
+        }
+    });
+}
+
+float Scene::get_lod_max_error() const {
+    const float pixels_per_radian = 0.5f * static_cast<float>(Window::get_height()) /
+                                    std::tan(0.5f * glm::radians(camera.get_fov()));
+    return LOD_PIXEL_ERROR / pixels_per_radian;
+}
+
+void Scene::update_lods() {
+    if (lod_chains.empty()) return;
+
+    // A level is used while its object space error projects to less than a pixel at the nearest point of the mesh
+    const glm::vec3 camera_pos = camera.get_pos();
+    const float max_error = get_lod_max_error();
+
+    // Scattered instances pick their levels while they are generated, any camera change regenerates and refits
+    // them, the generation pass reports the ones that switched levels
+    if (!scatter_lods.empty() && (camera_pos != scatter_lod_camera_pos || max_error != scatter_lod_max_error)) {
+        scatter_lod_camera_pos = camera_pos;
+        scatter_lod_max_error = max_error;
+        scatter_lods_dirty = true;
+    }
+
+    if (tlas_instances.lods.empty()) return;
+
+    std::atomic changed = false;
+    JobSystem::parallel_for(tlas_instances.lods.size(), TLAS_INSTANCE_MIN_BATCH, [&](const size_t begin, const size_t end) {
+        bool batch_changed = false;
+        for (size_t i = begin; i < end; ++i) {
+            const auto& blas = blases[tlas_instances.blases[i]];
+            if (blas.lod_chain == UINT32_MAX) continue;
+            const auto& chain = lod_chains[blas.lod_chain];
+
+            const glm::mat4& transform = tlas_instances.transforms[i];
+            const float scale = std::max({
+                glm::length(glm::vec3(transform[0])),
+                glm::length(glm::vec3(transform[1])),
+                glm::length(glm::vec3(transform[2]))
+            });
+            const glm::vec3 center = glm::vec3(transform * glm::vec4(chain.center, 1.0f));
+            const float distance = std::max(glm::length(center - camera_pos) - chain.radius * scale, LOD_MIN_DISTANCE);
+
+            uint8_t lod = 0;
+            while (lod + 1u < chain.errors.size() && chain.errors[lod + 1] * scale <= max_error * distance) {
+                ++lod;
+            }
+
+            if (tlas_instances.lods[i] != lod) {
+                tlas_instances.lods[i] = lod;
+                batch_changed = true;
+            }
+        }
+        if (batch_changed) changed = true;
+    });
+
+    if (changed) {
+        lods_dirty = true;
+    }
+}
+
+void Scene::apply_poses() {
+    posed_instances.clear();
+    for (uint32_t instance_idx = 0; instance_idx < model_instances.size(); ++instance_idx) {
+        const auto& model_instance = model_instances[instance_idx];
+        if (model_instance.animation_state == UINT32_MAX) continue;
+
+        const auto& pose = animation_states[model_instance.animation_state].pose;
+        if (pose.node_transforms.empty()) continue;
+        posed_instances.push_back(instance_idx);
+
+        const auto& nodes = model_instance.model->nodes;
+        uint32_t tlas_idx = model_instance.first_tlas_instance;
+        for (const auto& node : nodes) {
+            const glm::mat4 transform = model_instance.transform * pose.node_transforms[node.node_index];
+            for (uint32_t blas_idx = model_instance.first_blas + node.mesh_index; blas_idx != UINT32_MAX;
+                 blas_idx = blases[blas_idx].next_blas) {
+                tlas_instances.transforms[tlas_idx++] = transform;
+            }
+        }
+    }
+
+    for (const auto& state : animation_states) {
+        if (state.pose.node_transforms.empty()) continue;
+
+        const Model& model = *state.model;
+        for (const auto& deformed : state.deformed_nodes) {
+            const auto& node = model.nodes[deformed.node];
+
+            // Joints are expressed relative to the mesh node, whose transform stays in the TLAS instance
+            if (deformed.first_joint != UINT32_MAX) {
+                const auto& skin = model.skins[node.skin_index];
+                const glm::mat4 inverse_node = glm::inverse(state.pose.node_transforms[node.node_index]);
+                for (size_t j = 0; j < skin.joints.size(); ++j) {
+                    joint_matrices[deformed.first_joint + j] = inverse_node *
+                                                               state.pose.node_transforms[skin.joints[j]] *
+                                                               skin.inverse_bind_matrices[j];
+                }
+            }
+
+            const auto& weights = state.pose.node_weights[node.node_index];
+            const size_t weight_count = std::min(weights.size(), model.meshes[node.mesh_index].weights.size());
+            std::copy_n(weights.begin(), weight_count, morph_weights.begin() + deformed.first_weight);
+        }
+    }
+
+    poses_dirty = true;
+}
+
+void Scene::record_updates(const Context& ctx,
+                           const vk::raii::CommandBuffer& cmd,
+                           const uint32_t frame_index,
+                           const ComputePipeline& deform_pipeline) {
+    if (tlas_instances.transforms.size() + generated_instance_count == 0) return;
+
+    // The generation pass last recorded with this frame index flags scattered instances that switched levels. They
+    // have been refit since, a rebuild restores the topology of the TLAS
+    bool scatter_lods_changed = false;
+    if (frame_index < frame_update_buffers.size()) {
+        const auto& lod_changed = frame_update_buffers[frame_index].lod_changed;
+        vmaInvalidateAllocation(ctx.get_allocator().get(), lod_changed.get_allocation(), 0, VK_WHOLE_SIZE);
+        scatter_lods_changed = *lod_changed.mapped_ptr<uint32_t>() != 0;
+    }
+
+    if (!poses_dirty && !lods_dirty && !scatter_lods_dirty && !scatter_lods_changed) return;
+    const bool rebuild = lods_dirty || scatter_lods_changed;
+    poses_dirty = false;
+    lods_dirty = false;
+    scatter_lods_dirty = false;
+
+    auto create_frame_buffer = [&](const vk::DeviceSize size) {
+        return BufferBuilder()
+               .size(std::max<vk::DeviceSize>(size, 16))
+               .usage(vk::BufferUsageFlagBits::eStorageBuffer |
+                      vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR |
+                      vk::BufferUsageFlagBits::eShaderDeviceAddress |
+                      vk::BufferUsageFlagBits::eTransferSrc)
+               .allocation_flags(VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                                 VMA_ALLOCATION_CREATE_MAPPED_BIT)
+               .build(ctx.get_allocator());
+    };
+
+    while (frame_update_buffers.size() <= frame_index) {
+        frame_update_buffers.push_back({
+            .tlas_instances = create_frame_buffer(tlas_instances.transforms.size() *
+                                                  sizeof(vk::AccelerationStructureInstanceKHR)),
+            .joint_matrices = create_frame_buffer(joint_matrices.size() * sizeof(glm::mat4)),
+            .morph_weights = create_frame_buffer(morph_weights.size() * sizeof(float)),
+            .light_instances = create_frame_buffer(light_instances.size() * sizeof(LightInstance)),
+            .light_nodes = create_frame_buffer(instance_light_tree.get_nodes().size() * sizeof(LightNode)),
+            .lod_changed = BufferBuilder()
+                           .size(sizeof(uint32_t))
+                           .usage(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress)
+                           .allocation_flags(VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                                             VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                           .build(ctx.get_allocator()),
+        });
+    }
+
+    // The fence of this frame index has been waited on, so the GPU is done reading these buffers
+    const auto& frame_buffers = frame_update_buffers[frame_index];
+    write_tlas_instances(static_cast<vk::AccelerationStructureInstanceKHR*>(frame_buffers.tlas_instances.mapped_ptr()));
+    memcpy(frame_buffers.joint_matrices.mapped_ptr(), joint_matrices.data(), joint_matrices.size() * sizeof(glm::mat4));
+    memcpy(frame_buffers.morph_weights.mapped_ptr(), morph_weights.data(), morph_weights.size() * sizeof(float));
+    *frame_buffers.lod_changed.mapped_ptr<uint32_t>() = 0;
+    vmaFlushAllocation(ctx.get_allocator().get(), frame_buffers.lod_changed.get_allocation(), 0, VK_WHOLE_SIZE);
+
+    record_light_update(cmd, frame_buffers);
+    record_deformation(ctx, cmd, frame_buffers, deform_pipeline);
+    record_instance_upload(cmd, frame_buffers.tlas_instances);
+    record_instance_generation(ctx,
+                               cmd,
+                               tlas_instance_buffer.get_device_address(ctx.get_device()),
+                               frame_buffers.lod_changed.get_device_address(ctx.get_device()));
+    record_tlas_update(ctx, cmd, rebuild);
+}
+
+void Scene::record_light_update(const vk::raii::CommandBuffer& cmd, const FrameUpdateBuffers& frame_buffers) {
+    if (posed_instances.empty() || light_instances.empty()) return;
+
+    // Only the TLAS instances of posed model instances moved, each owns its light instances. Analytic ones come
+    // after the TLAS ordered ones and never move
+    JobSystem::parallel_for(posed_instances.size(), MODEL_INSTANCE_MIN_BATCH, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const auto& model_instance = model_instances[posed_instances[i]];
+            const uint32_t tlas_end = model_instance.first_tlas_instance + model_instance.tlas_instance_count;
+            for (uint32_t tlas_idx = model_instance.first_tlas_instance; tlas_idx < tlas_end; ++tlas_idx) {
+                const uint32_t light_instance = instance_lights[tlas_idx];
+                if (light_instance == UINT32_MAX) continue;
+
+                const glm::mat4& transform = tlas_instances.transforms[tlas_idx];
+                light_instances[light_instance].object_to_world = transform;
+                light_instances[light_instance].world_to_object = glm::inverse(transform);
+                light_world_bounds[light_instance] = transform_light_bounds(light_instance_bounds[light_instance], transform);
+            }
+        }
+    });
+    posed_instances.clear();
+    instance_light_tree.refit(light_world_bounds);
+
+    const auto& nodes = instance_light_tree.get_nodes();
+    memcpy(frame_buffers.light_instances.mapped_ptr(), light_instances.data(), light_instances.size() * sizeof(LightInstance));
+    memcpy(frame_buffers.light_nodes.mapped_ptr(), nodes.data(), nodes.size() * sizeof(LightNode));
+
+    // The previous frame may still be sampling the lights
+    vk::MemoryBarrier2 pre_copy_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+        .srcAccessMask = vk::AccessFlagBits2::eShaderRead,
+        .dstStageMask = vk::PipelineStageFlagBits2::eCopy,
+        .dstAccessMask = vk::AccessFlagBits2::eTransferWrite,
+    };
+
+    cmd.pipelineBarrier2(vk::DependencyInfo{
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &pre_copy_barrier,
+    });
+
+    cmd.copyBuffer(frame_buffers.light_instances.get(), light_instance_buffer.get(),
+                   vk::BufferCopy{.size = light_instances.size() * sizeof(LightInstance)});
+    if (!nodes.empty()) {
+        // The top-level tree comes first in the node buffer, the BLAS trees after it are in object space
+        cmd.copyBuffer(frame_buffers.light_nodes.get(), light_node_buffer.get(),
+                       vk::BufferCopy{.size = nodes.size() * sizeof(LightNode)});
+    }
+
+    vk::MemoryBarrier2 copy_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eCopy,
+        .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderRead,
+    };
+
+    cmd.pipelineBarrier2(vk::DependencyInfo{
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &copy_barrier,
+    });
+}
+
+void Scene::record_deformation(const Context& ctx,
+                               const vk::raii::CommandBuffer& cmd,
+                               const FrameUpdateBuffers& frame_buffers,
+                               const ComputePipeline& deform_pipeline) {
+    if (deformers.empty()) return;
+
+    // Previous frame traced against the deformed vertices and may still be refitting with the shared scratch buffer
+    vk::MemoryBarrier2 pre_deform_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eRayTracingShaderKHR |
+                        vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+        .srcAccessMask = vk::AccessFlagBits2::eShaderRead |
+                         vk::AccessFlagBits2::eAccelerationStructureReadKHR |
+                         vk::AccessFlagBits2::eAccelerationStructureWriteKHR,
+        .dstStageMask = vk::PipelineStageFlagBits2::eComputeShader |
+                        vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderWrite |
+                         vk::AccessFlagBits2::eAccelerationStructureReadKHR |
+                         vk::AccessFlagBits2::eAccelerationStructureWriteKHR,
+    };
+
+    cmd.pipelineBarrier2(vk::DependencyInfo{
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &pre_deform_barrier,
+    });
+
+    const auto vertex_address = vertex_buffer.get_device_address(ctx.get_device());
+    const auto index_address = index_buffer.get_device_address(ctx.get_device());
+    const auto joint_address = frame_buffers.joint_matrices.get_device_address(ctx.get_device());
+    const auto weight_address = frame_buffers.morph_weights.get_device_address(ctx.get_device());
+    const vk::DeviceAddress skin_address = skin_vertices.empty()
+                                               ? 0
+                                               : skin_vertex_buffer.get_device_address(ctx.get_device());
+    const vk::DeviceAddress morph_address = morph_deltas.empty()
+                                                ? 0
+                                                : morph_delta_buffer.get_device_address(ctx.get_device());
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, deform_pipeline.get());
+
+    for (const auto& state : animation_states) {
+        for (const auto& deformed : state.deformed_nodes) {
+            for (uint32_t i = 0; i < deformed.deformer_count; ++i) {
+                const auto& deformer = deformers[deformed.first_deformer + i];
+                const bool skinned = deformed.first_joint != UINT32_MAX && deformer.skin_offset != UINT32_MAX;
+
+                DeformPushData push_data{
+                    .src_vertices = vertex_address + deformer.src_vertex_offset * sizeof(Vertex),
+                    .dst_vertices = vertex_address + deformer.dst_vertex_offset * sizeof(Vertex),
+                    .skin_vertices = skinned ? skin_address + deformer.skin_offset * sizeof(SkinVertex) : 0,
+                    .morph_deltas = deformer.morph_target_count > 0
+                                        ? morph_address + deformer.morph_offset * sizeof(MorphDelta)
+                                        : 0,
+                    .morph_weights = weight_address + deformed.first_weight * sizeof(float),
+                    .joint_matrices = skinned ? joint_address + deformed.first_joint * sizeof(glm::mat4) : 0,
+                    .vertex_count = deformer.vertex_count,
+                    .morph_target_count = deformer.morph_target_count,
+                    .skinned = skinned ? 1u : 0u,
+                };
+
+                cmd.pushConstants2(vk::PushConstantsInfo{
+                    .layout = deform_pipeline.get_layout(),
+                    .stageFlags = vk::ShaderStageFlagBits::eCompute,
+                    .offset = 0,
+                    .size = sizeof(DeformPushData),
+                    .pValues = &push_data,
+                });
+                cmd.dispatch((deformer.vertex_count + 63) / 64, 1, 1);
+            }
+        }
+    }
+
+    vk::MemoryBarrier2 deform_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+        .srcAccessMask = vk::AccessFlagBits2::eShaderWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR |
+                        vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderRead,
+    };
+
+    cmd.pipelineBarrier2(vk::DependencyInfo{
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &deform_barrier,
+    });
+
+    // Refit every deformed BLAS in one call, each one owns a separate scratch range
+    std::vector<BlasGeometry> blas_geometries;
+    std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> build_infos;
+    std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> range_infos;
+
+    const auto scratch_address = blas_update_scratch_buffer.get_device_address(ctx.get_device());
+
+    for (const auto& state : animation_states) {
+        for (const auto& deformed : state.deformed_nodes) {
+            blas_geometries.push_back(get_blas_geometry(blases[deformed.blas], vertex_address, index_address, 0));
+        }
+    }
+
+    size_t geometry_idx = 0;
+    for (const auto& state : animation_states) {
+        for (const auto& deformed : state.deformed_nodes) {
+            const auto& blas = blases[deformed.blas];
+            const auto& blas_geometry = blas_geometries[geometry_idx++];
+
+            build_infos.push_back(vk::AccelerationStructureBuildGeometryInfoKHR{
+                .type = vk::AccelerationStructureTypeKHR::eBottomLevel,
+                .flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace |
+                         vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate,
+                .mode = vk::BuildAccelerationStructureModeKHR::eUpdate,
+                .srcAccelerationStructure = blas.as.get_handle(),
+                .dstAccelerationStructure = blas.as.get_handle(),
+                .geometryCount = static_cast<uint32_t>(blas_geometry.geometries.size()),
+                .pGeometries = blas_geometry.geometries.data(),
+                .scratchData = scratch_address + blas.update_scratch_offset,
+            });
+            range_infos.push_back(blas_geometry.ranges.data());
+        }
+    }
+
+    cmd.buildAccelerationStructuresKHR(build_infos, range_infos);
+}
+
+void Scene::record_tlas_update(const Context& ctx, const vk::raii::CommandBuffer& cmd, const bool rebuild) {
+    // Previous frame traced against the TLAS and may still be refitting it with the shared scratch buffer,
+    // this frame's BLAS refits must finish before the TLAS reads them
+    vk::MemoryBarrier2 pre_update_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eRayTracingShaderKHR |
+                        vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+        .srcAccessMask = vk::AccessFlagBits2::eAccelerationStructureReadKHR |
+                         vk::AccessFlagBits2::eAccelerationStructureWriteKHR,
+        .dstStageMask = vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+        .dstAccessMask = vk::AccessFlagBits2::eAccelerationStructureReadKHR |
+                         vk::AccessFlagBits2::eAccelerationStructureWriteKHR,
+    };
+
+    cmd.pipelineBarrier2(vk::DependencyInfo{
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &pre_update_barrier,
+    });
+
+    vk::AccelerationStructureGeometryInstancesDataKHR instances_data{
+        .arrayOfPointers = vk::False,
+        .data = tlas_instance_buffer.get_device_address(ctx.get_device()),
+    };
+
+    vk::AccelerationStructureGeometryKHR geometry{
+        .geometryType = vk::GeometryTypeKHR::eInstances,
+        .geometry = instances_data,
+        .flags = vk::GeometryFlagBitsKHR::eOpaque,
+    };
+
+    vk::AccelerationStructureBuildGeometryInfoKHR geometry_info{
+        .type = vk::AccelerationStructureTypeKHR::eTopLevel,
+        .flags = tlas_build_flags,
+        .mode = rebuild ? vk::BuildAccelerationStructureModeKHR::eBuild : vk::BuildAccelerationStructureModeKHR::eUpdate,
+        .srcAccelerationStructure = rebuild ? vk::AccelerationStructureKHR{} : tlas.get_handle(),
+        .dstAccelerationStructure = tlas.get_handle(),
+        .geometryCount = 1,
+        .pGeometries = &geometry,
+        .scratchData = tlas_scratch_buffer.get_device_address(ctx.get_device()),
+    };
+
+    vk::AccelerationStructureBuildRangeInfoKHR range_info{
+        .primitiveCount = static_cast<uint32_t>(tlas_instances.transforms.size()) + generated_instance_count,
+    };
+
+    cmd.buildAccelerationStructuresKHR({geometry_info}, {&range_info});
+
+    vk::MemoryBarrier2 post_update_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+        .srcAccessMask = vk::AccessFlagBits2::eAccelerationStructureWriteKHR,
+        .dstStageMask = vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+        .dstAccessMask = vk::AccessFlagBits2::eAccelerationStructureReadKHR,
+    };
+
+    cmd.pipelineBarrier2(vk::DependencyInfo{
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &post_update_barrier,
+    });
+}
+
 void Scene::build_light_buffer(const Context& ctx) {
     spdlog::info("Building light buffer...");
 
-    for (const auto& instance : model_instances) {
-        const auto& model = instance.model;
-        for (const auto& node : model->nodes) {
-            glm::mat4 world_transform = instance.transform * node.transform;
-
-            const auto& mesh = model->meshes[node.mesh_index];
-            for (const auto& primitive : mesh.primitives) {
-                const auto& material = model->materials[primitive.material_index];
-                if (material.emissive_factor.r == 0.0f &&
-                    material.emissive_factor.g == 0.0f &&
-                    material.emissive_factor.b == 0.0f &&
-                    material.emissive_index == UINT32_MAX) {
-                    continue;
-                }
+    // Counting pass over the BLASes the TLAS references, the lights of a BLAS are shared by all of its instances.
+    // Deformed copies carry no lights, their emitters are only found by BSDF sampling
+    std::vector<LightSource> sources;
+    std::vector<uint32_t> emissive_blases;
+    std::vector visited_blases(blases.size(), false);
+    uint32_t light_count = 0;
+    for (const uint32_t blas_idx : tlas_instances.blases) {
+        auto& blas = blases[blas_idx];
+        if (visited_blases[blas_idx] || blas.light_count == 0) continue;
+        visited_blases[blas_idx] = true;
 
-                const uint32_t num_triangles = primitive.indices.size() / 3;
-                for (uint32_t triangle_idx = 0; triangle_idx < num_triangles; ++triangle_idx) {
-                    const uint32_t i0 = primitive.indices[triangle_idx * 3 + 0];
-                    const uint32_t i1 = primitive.indices[triangle_idx * 3 + 1];
-                    const uint32_t i2 = primitive.indices[triangle_idx * 3 + 2];
-
-                    const glm::vec3 v0 = world_transform * glm::vec4(primitive.vertices[i0].position, 1.0f);
-                    const glm::vec3 v1 = world_transform * glm::vec4(primitive.vertices[i1].position, 1.0f);
-                    const glm::vec3 v2 = world_transform * glm::vec4(primitive.vertices[i2].position, 1.0f);
-
-                    const float area = 0.5f * glm::length(glm::cross(v1 - v0, v2 - v0));
-                    if (area < 1e-6f) continue;
-
-                    lights.push_back({
-                        .emission = material.emissive_factor,
-                        .v0 = v0,
-                        .v1 = v1,
-                        .v2 = v2,
-                        .area = area
-                    });
+        blas.first_light = light_count;
+        emissive_blases.push_back(blas_idx);
+
+        for (uint32_t i = 0; i < blas.geometry_count; ++i) {
+            const auto& geometry = geometries[blas.geometry_offset + i];
+            if (geometry.light_offset == UINT32_MAX) continue;
+
+            const uint32_t num_triangles = geometry.index_count / 3;
+            const Material& material = materials[geometry.material_index];
+            sources.push_back({
+                .geometry = blas.geometry_offset + i,
+                .emission = material.emissive_factor,
+                .emissive_texture = material.emissive_index != UINT32_MAX
+                                        ? texture_data[material.emissive_index]
+                                        : nullptr,
+                .emissive_index = material.emissive_index,
+                .first_light = light_count,
+                .light_count = num_triangles
+            });
+            light_count += num_triangles;
+        }
+    }
+
+    // Every thread fills its own contiguous block of lights, which may span several sources
+    lights.resize(light_count);
+    JobSystem::parallel_for(light_count, LIGHT_EXTRACTION_MIN_BATCH, [&](const size_t begin, const size_t end) {
+        auto source = std::ranges::upper_bound(sources, begin, {}, &LightSource::first_light) - 1;
+        for (size_t light = begin; light < end; ++source) {
+            const size_t source_end = std::min<size_t>(source->first_light + source->light_count, end);
+            const auto& geometry = geometries[source->geometry];
+            const Vertex* source_vertices = vertices.data() + geometry.vertex_offset;
+            const uint32_t* source_indices = indices.data() + geometry.index_offset;
+
+            for (; light < source_end; ++light) {
+                const size_t first_index = (light - source->first_light) * 3;
+                const glm::vec3& v0 = source_vertices[source_indices[first_index + 0]].position;
+                const glm::vec3& v1 = source_vertices[source_indices[first_index + 1]].position;
+                const glm::vec3& v2 = source_vertices[source_indices[first_index + 2]].position;
+
+                const glm::vec2 uv[3] = {
+                    source_vertices[source_indices[first_index + 0]].texcoord,
+                    source_vertices[source_indices[first_index + 1]].texcoord,
+                    source_vertices[source_indices[first_index + 2]].texcoord,
+                };
+                glm::vec3 emission = source->emission;
+                if (source->emissive_texture) {
+                    emission *= average_triangle_emission(uv, *source->emissive_texture);
                 }
+
+                // Degenerate and black triangles are kept with zero area to preserve the layout, they are left out
+                // of the light trees and never sampled
+                float area = 0.5f * glm::length(glm::cross(v1 - v0, v2 - v0));
+                if (area < 1e-6f || emission == glm::vec3(0.0f)) area = 0.0f;
+
+                lights[light] = {
+                    .emission = emission,
+                    .v0 = v0,
+                    .v1 = v1,
+                    .v2 = v2,
+                    .area = area,
+                    .emissive_texture = source->emissive_texture ? source->emissive_index : UINT32_MAX,
+                    .emissive_factor = source->emission,
+                    .uv0 = uv[0],
+                    .uv1 = uv[1],
+                    .uv2 = uv[2]
+                };
+            }
+        }
+    });
+
+    // Object space light tree of every emissive BLAS
+    std::vector<LightTree> blas_trees(emissive_blases.size());
+    std::vector<LightBounds> blas_bounds(emissive_blases.size());
+    JobSystem::parallel_for(emissive_blases.size(), 1, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const auto& blas = blases[emissive_blases[i]];
+            const std::span blas_lights(lights.data() + blas.first_light, blas.light_count);
+
+            std::vector<LightBounds> bounds(blas_lights.size());
+            std::vector<uint64_t> bit_trails(blas_lights.size());
+            for (size_t j = 0; j < blas_lights.size(); ++j) {
+                bounds[j] = triangle_light_bounds(blas_lights[j]);
             }
+
+            blas_trees[i].build(bounds, bit_trails);
+            for (size_t j = 0; j < blas_lights.size(); ++j) {
+                blas_lights[j].bit_trail = bit_trails[j];
+            }
+            if (blas_trees[i].get_nodes().empty()) continue;
+
+            const LightNode& root = blas_trees[i].get_nodes()[0];
+            blas_bounds[i] = {
+                .min = root.bounds_min,
+                .max = root.bounds_max,
+                .phi = root.phi,
+                .axis = root.axis,
+                .cos_theta_o = root.cos_theta_o,
+                .cos_theta_e = root.cos_theta_e
+            };
         }
+    });
+
+    std::vector<uint32_t> blas_tree_indices(blases.size(), UINT32_MAX);
+    uint32_t blas_node_count = 0;
+    for (uint32_t i = 0; i < emissive_blases.size(); ++i) {
+        blas_tree_indices[emissive_blases[i]] = i;
+        blases[emissive_blases[i]].first_light_node = blas_node_count;
+        blas_node_count += static_cast<uint32_t>(blas_trees[i].get_nodes().size());
     }
 
-    if (lights.empty()) {
-        lights.push_back({});
+    // Power-weighted alias table of every emissive BLAS, entries are relative to the BLAS's first light
+    AliasTable alias_table;
+    std::vector<AliasEntry> light_alias_entries(light_count);
+    std::vector<float> weights;
+    for (const uint32_t blas_idx : emissive_blases) {
+        const auto& blas = blases[blas_idx];
+        weights.resize(blas.light_count);
+        for (uint32_t i = 0; i < blas.light_count; ++i) {
+            const Light& light = lights[blas.first_light + i];
+            weights[i] = luminance(light.emission) * light.area;
+        }
+        alias_table.build(weights);
+        std::ranges::copy(alias_table.get_entries(), light_alias_entries.begin() + blas.first_light);
     }
 
-    light_buffer = BufferBuilder()
-                   .size(sizeof(Light) * lights.size())
-                   .usage(vk::BufferUsageFlagBits::eShaderDeviceAddress)
-                   .allocation_flags(VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
-                                     VMA_ALLOCATION_CREATE_MAPPED_BIT)
-                   .build(ctx.get_allocator());
+    // Same order as the TLAS instances, so hits can find their light instance through InstanceIndex()
+    std::vector<LightBounds> instance_bounds;
+    instance_lights.clear();
+    light_instances.clear();
+    light_instance_bounds.clear();
+    num_lights = 0;
+    for (size_t tlas_idx = 0; tlas_idx < tlas_instances.blases.size(); ++tlas_idx) {
+        // BLASes whose triangles all turned out black keep their geometry but get no light instance, neither do
+        // the deformed copies of emissive meshes
+        const uint32_t blas_idx = tlas_instances.blases[tlas_idx];
+        const auto& blas = blases[blas_idx];
+        if (blas.light_count == 0 || blas_trees[blas_tree_indices[blas_idx]].get_nodes().empty()) {
+            instance_lights.push_back(UINT32_MAX);
+            continue;
+        }
+
+        const glm::mat4& world_transform = tlas_instances.transforms[tlas_idx];
+        instance_lights.push_back(static_cast<uint32_t>(light_instances.size()));
+        light_instances.push_back({
+            .object_to_world = world_transform,
+            .world_to_object = glm::inverse(world_transform),
+            .first_light = blas.first_light,
+            .light_count = blas.light_count,
+            .first_node = blas.first_light_node
+        });
+        light_instance_bounds.push_back(blas_bounds[blas_tree_indices[blas_idx]]);
+        instance_bounds.push_back(transform_light_bounds(light_instance_bounds.back(), world_transform));
+        num_lights += blas.light_count;
+    }
 
-    memcpy(light_buffer.mapped_ptr(), lights.data(), lights.size() * sizeof(Light));
+    // Scattered instances have no light instance, their emissive hits are only found by BSDF sampling
+    instance_lights.resize(instance_lights.size() + generated_instance_count, UINT32_MAX);
+
+    // Analytic lights in world space, each one a light instance with a single leaf as its tree
+    std::vector<Light> world_lights = analytic_lights;
+    for (const auto& instance : model_instances) {
+        for (const auto& light : instance.model->lights) {
+            world_lights.push_back(transform_light(light, instance.transform));
+        }
+    }
+
+    std::vector<LightNode> analytic_nodes;
+    for (const auto& light : world_lights) {
+        const LightBounds bounds = analytic_light_bounds(light);
+        light_instances.push_back({
+            .object_to_world = glm::mat4(1.0f),
+            .world_to_object = glm::mat4(1.0f),
+            .first_light = static_cast<uint32_t>(lights.size()),
+            .light_count = 1,
+            .first_node = blas_node_count + static_cast<uint32_t>(analytic_nodes.size())
+        });
+        analytic_nodes.push_back({
+            .bounds_min = bounds.min,
+            .phi = bounds.phi,
+            .bounds_max = bounds.max,
+            .second_child_or_light = 0,
+            .axis = bounds.axis,
+            .cos_theta_o = bounds.cos_theta_o,
+            .cos_theta_e = bounds.cos_theta_e,
+            .is_leaf = 1
+        });
+        light_alias_entries.push_back({.probability = 1.0f, .alias = 0, .pmf = 1.0f});
+        light_instance_bounds.push_back(bounds);
+        instance_bounds.push_back(bounds);
+        lights.push_back(light);
+        ++num_lights;
+    }
+
+    // World space tree over the light instances, the BLAS trees follow it in the node buffer
+    std::vector<uint64_t> instance_bit_trails(light_instances.size());
+    instance_light_tree.build(instance_bounds, instance_bit_trails);
+    light_world_bounds = instance_bounds;
+
+    std::vector<LightNode> light_nodes = instance_light_tree.get_nodes();
+    const auto instance_node_count = static_cast<uint32_t>(light_nodes.size());
+    for (uint32_t i = 0; i < light_instances.size(); ++i) {
+        light_instances[i].bit_trail = instance_bit_trails[i];
+        light_instances[i].first_node += instance_node_count;
+    }
+    for (const auto& blas_tree : blas_trees) {
+        light_nodes.insert(light_nodes.end(), blas_tree.get_nodes().begin(), blas_tree.get_nodes().end());
+    }
+    light_nodes.insert(light_nodes.end(), analytic_nodes.begin(), analytic_nodes.end());
+
+    // Light instances by power, then by light count for uniform selection over all lights of the scene
+    std::vector<AliasEntry> instance_alias_entries;
+    weights.resize(light_instances.size());
+    for (uint32_t i = 0; i < light_instances.size(); ++i) {
+        weights[i] = instance_bounds[i].phi;
+    }
+    alias_table.build(weights);
+    instance_alias_entries.insert(instance_alias_entries.end(), alias_table.get_entries().begin(), alias_table.get_entries().end());
+    for (uint32_t i = 0; i < light_instances.size(); ++i) {
+        weights[i] = static_cast<float>(light_instances[i].light_count);
+    }
+    alias_table.build(weights);
+    instance_alias_entries.insert(instance_alias_entries.end(), alias_table.get_entries().begin(), alias_table.get_entries().end());
+
+    spdlog::info("Built light trees over {} lights in {} BLASes and {} instances, {} of them analytic",
+                 lights.size(), emissive_blases.size(), light_instances.size(), world_lights.size());
+
+    // Scenes without lights still get one zeroed entry per buffer, so unguarded reads stay in bounds
+    const auto upload = [&]<typename T>(const std::vector<T>& data, const vk::BufferUsageFlags usage = {}) {
+        Buffer buffer = BufferBuilder()
+                        .size(sizeof(T) * std::max<size_t>(data.size(), 1))
+                        .usage(vk::BufferUsageFlagBits::eShaderDeviceAddress | usage)
+                        .allocation_flags(VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                                          VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                        .build(ctx.get_allocator());
+        if (data.empty()) {
+            const T empty{};
+            memcpy(buffer.mapped_ptr(), &empty, sizeof(T));
+        } else {
+            memcpy(buffer.mapped_ptr(), data.data(), data.size() * sizeof(T));
+        }
+        return buffer;
+    };
+
+    light_buffer = upload(lights);
+    // Animated scenes copy moved light instances and the refit top-level tree over these
+    light_node_buffer = upload(light_nodes, vk::BufferUsageFlagBits::eTransferDst);
+    light_instance_buffer = upload(light_instances, vk::BufferUsageFlagBits::eTransferDst);
+    instance_light_buffer = upload(instance_lights);
+    light_alias_buffer = upload(light_alias_entries);
+    instance_alias_buffer = upload(instance_alias_entries);
 
     scene_ptrs.lights = light_buffer.get_device_address(ctx.get_device());
+    scene_ptrs.light_nodes = light_node_buffer.get_device_address(ctx.get_device());
+    scene_ptrs.light_instances = light_instance_buffer.get_device_address(ctx.get_device());
+    scene_ptrs.instance_lights = instance_light_buffer.get_device_address(ctx.get_device());
+    scene_ptrs.light_alias_table = light_alias_buffer.get_device_address(ctx.get_device());
+    scene_ptrs.instance_alias_table = instance_alias_buffer.get_device_address(ctx.get_device());
+}
+
+void Scene::load_environment(const std::filesystem::path& path) {
+    if (environment_job.valid()) {
+        environment_job.wait();
+    }
+    environment_job = JobSystem::submit([this, path] {
+        environment_data = load_environment_data(path);
+    });
+}
+
+void Scene::build_environment(const Context& ctx) {
+    if (!environment_job.valid()) return;
+    environment_job.get();
+    if (environment_data.pixels.empty()) return;
+
+    spdlog::info("Building environment...");
+
+    auto image = ImageBuilder()
+                 .type(vk::ImageType::e2D)
+                 .format(vk::Format::eR16G16B16A16Sfloat)
+                 .size(environment_data.width, environment_data.height)
+                 .mip_levels(1)
+                 .layers(1)
+                 .samples(vk::SampleCountFlagBits::e1)
+                 .usage(vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled)
+                 .build(ctx.get_allocator());
+
+    image.upload_data(environment_data.pixels.data(),
+                      environment_data.pixels.size() * sizeof(uint16_t),
+                      ctx.get_device());
+
+    environment_alias_buffer = BufferBuilder()
+                               .size(environment_data.alias_entries.size() * sizeof(AliasEntry))
+                               .usage(vk::BufferUsageFlagBits::eShaderDeviceAddress)
+                               .allocation_flags(VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                                                 VMA_ALLOCATION_CREATE_MAPPED_BIT)
+                               .build(ctx.get_allocator());
+    memcpy(environment_alias_buffer.mapped_ptr(),
+           environment_data.alias_entries.data(),
+           environment_data.alias_entries.size() * sizeof(AliasEntry));
+
+    environment_map = {
+        .alias_table = environment_alias_buffer.get_device_address(ctx.get_device()),
+        .texture_index = static_cast<uint32_t>(images.size()),
+        .width = environment_data.width,
+        .height = environment_data.height
+    };
+
+    image_views.emplace_back(ctx.get_device(), image, vk::ImageViewType::e2D, vk::ImageAspectFlagBits::eColor, 0, 1);
+    images.push_back(std::move(image));
+    texture_data.push_back(nullptr);
+
+    environment_data = {};
 }
 
 void Scene::build_descriptor_set(const Context& ctx) {
@@ -1,22 +1,119 @@
 #pragma once
 
+#include <future>
+#include <memory>
+
 #include "camera.h"
 #include "context.h"
+#include "alias_table.h"
+#include "environment.h"
+#include "light_tree.h"
 #include "model.h"
 
 #include "vulkan/acceleration.h"
+#include "vulkan/acceleration_cache.h"
 #include "vulkan/image.h"
+#include "vulkan/pipeline.h"
 
 struct ModelInstance {
     std::shared_ptr<Model> model;
     glm::mat4 transform;
     uint32_t first_blas;
+    uint32_t animation_state = UINT32_MAX;
+    uint32_t first_tlas_instance = 0;
+    uint32_t tlas_instance_count = 0; // One per BLAS in the chain of every node
+};
+
+// One compute dispatch, deforms a primitive from its bind pose vertices into its own vertex range
+struct Deformer {
+    uint32_t src_vertex_offset;
+    uint32_t dst_vertex_offset;
+    uint32_t vertex_count;
+    uint32_t skin_offset = UINT32_MAX; // Into Scene::skin_vertices
+    uint32_t morph_offset = UINT32_MAX; // Into Scene::morph_deltas
+    uint32_t morph_target_count = 0;
+};
+
+// Skinned or morphed node with its own deformed copy of the mesh and a refittable BLAS
+struct DeformedNode {
+    uint32_t node; // Index into Model::nodes
+    uint32_t blas;
+    uint32_t first_deformer;
+    uint32_t deformer_count;
+    uint32_t first_joint = UINT32_MAX; // Into Scene::joint_matrices, UINT32_MAX when not skinned
+    uint32_t first_weight; // Into Scene::morph_weights
+};
+
+// Shared by every instance of an animated model
+struct AnimationState {
+    Model* model;
+    uint32_t animation_index;
+    Pose pose;
+
+    std::vector<DeformedNode> deformed_nodes;
+    std::vector<uint32_t> node_blases; // Deformed BLAS per Model::nodes entry, UINT32_MAX for rigid nodes
 };
 
 struct Blas {
     AccelerationStructure as;
     uint32_t geometry_offset;
     uint32_t geometry_count;
+    bool deformable = false;
+    uint32_t sbt_offset = HIT_GROUP_OPAQUE; // Also tells triangle BLASes from the analytic ones of each shape
+    uint32_t next_blas = UINT32_MAX; // Next BLAS of the same mesh, alpha tested triangles then analytic shapes
+    std::vector<uint32_t> primitives; // Mesh primitive of every geometry
+    uint32_t lod_chain = UINT32_MAX; // Into Scene::lod_chains, only set on the full detail BLAS
+    vk::DeviceSize update_scratch_offset = 0; // Into Scene::blas_update_scratch_buffer
+
+    // Object space emissive triangles, shared by every instance of the BLAS
+    uint32_t first_light = 0;
+    uint32_t light_count = 0;
+    uint32_t first_light_node = 0;
+};
+
+// Simplified BLASes of a rigid opaque mesh without emissive primitives, so swapping them leaves the TLAS
+// instance layout and the lights alone
+struct LodChain {
+    std::vector<uint32_t> blases; // Full detail first
+    std::vector<float> errors; // Object space error per level, 0 for the full detail one
+    glm::vec3 center; // Object space bounding sphere of the mesh
+    float radius;
+};
+
+// TLAS instances as separate arrays, expanded into instance records by a parallel fill
+struct TlasInstances {
+    std::vector<glm::mat4> transforms;
+    std::vector<uint32_t> blases; // Full detail BLAS, the level in lods picks from its chain
+    std::vector<uint8_t> lods;
+};
+
+// Randomly rotated instances on a cubic grid
+struct ScatterGrid {
+    uint32_t size = 0; // Instances per axis
+    float spacing = 2.0f;
+    glm::vec3 origin = glm::vec3(0.0f);
+    uint32_t seed = 0;
+};
+
+// Model instances whose TLAS records are generated by a compute pass, the CPU only keeps the grid rule. They
+// are rigid and never sampled as lights
+struct InstanceScatter {
+    std::shared_ptr<Model> model;
+    uint32_t first_blas;
+    uint32_t instance_count;
+    ScatterGrid grid;
+    uint32_t first_node = 0; // Into Scene::scatter_nodes
+    uint32_t node_count = 0; // TLAS instances per scattered instance
+};
+
+// Written by the CPU every animated frame, one set per frame in flight
+struct FrameUpdateBuffers {
+    Buffer tlas_instances; // Staging for the CPU written prefix of Scene::tlas_instance_buffer
+    Buffer joint_matrices;
+    Buffer morph_weights;
+    Buffer light_instances; // Staging for the moved light instances and the refit top-level light tree
+    Buffer light_nodes;
+    Buffer lod_changed; // Set by the instance generation when a scattered instance switched levels
 };
 
 class Scene {
@@ -30,16 +127,38 @@ class Scene {
     std::vector<uint32_t> indices;
     std::vector<Material> materials;
     std::vector<Geometry> geometries;
+    std::vector<ProceduralPrimitive> procedurals;
+    std::vector<vk::AabbPositionsKHR> procedural_bounds; // Build input of the analytic BLASes, one per procedural
     std::vector<Light> lights;
+    std::vector<Light> analytic_lights; // World space, from add_light
+    std::vector<LightInstance> light_instances;
+    std::vector<uint32_t> instance_lights;
+    uint32_t num_lights = 0;
+    LightTree instance_light_tree; // Over the light instances, refit when animated nodes move
+    std::vector<LightBounds> light_instance_bounds; // Before the instance transform, world space for analytic lights
+    std::vector<LightBounds> light_world_bounds; // Input of the refit, only the moved light instances are updated
 
     Buffer vertex_buffer;
     Buffer index_buffer;
     Buffer material_buffer;
     Buffer geometry_buffer;
+    Buffer procedural_buffer;
+    Buffer procedural_bounds_buffer;
     Buffer light_buffer;
+    Buffer light_node_buffer;
+    Buffer light_instance_buffer;
+    Buffer instance_light_buffer;
+    Buffer light_alias_buffer;
+    Buffer instance_alias_buffer;
 
     std::vector<Image> images;
     std::vector<ImageView> image_views;
+    std::vector<const TextureData*> texture_data; // CPU pixels of every image, owned by the models
+
+    EnvironmentData environment_data; // Written by environment_job, freed after the upload
+    std::future<void> environment_job;
+    EnvironmentMap environment_map{};
+    Buffer environment_alias_buffer;
 
     vk::raii::DescriptorPool descriptor_pool = nullptr;
     vk::raii::DescriptorSet descriptor_set = nullptr;
@@ -47,10 +166,91 @@ class Scene {
     ScenePtrs scene_ptrs{};
 
     std::vector<Blas> blases;
+    std::vector<LodChain> lod_chains;
     AccelerationStructure tlas;
+    vk::BuildAccelerationStructureFlagsKHR tlas_build_flags;
+
+    TlasInstances tlas_instances;
+    std::vector<InstanceScatter> scatters;
+    std::vector<ScatterNode> scatter_nodes;
+    Buffer scatter_node_buffer;
+    std::vector<ScatterLod> scatter_lods;
+    Buffer scatter_lod_buffer;
+    glm::vec3 scatter_lod_camera_pos = glm::vec3(0.0f); // Camera the scattered instances last picked their levels for
+    float scatter_lod_max_error = 0.0f;
+    std::unique_ptr<ComputePipeline> instance_pipeline;
+    uint32_t generated_instance_count = 0; // TLAS instances after the CPU written ones
+    Buffer tlas_instance_buffer; // Device local, CPU written instances followed by the generated ones
+    std::vector<FrameUpdateBuffers> frame_update_buffers;
+    Buffer tlas_scratch_buffer;
+    bool poses_dirty = false;
+    std::vector<uint32_t> posed_instances; // Model instances the last apply_poses moved
+    bool lods_dirty = false; // Rebuilds the TLAS, CPU written instances switched levels
+    bool scatter_lods_dirty = false; // Regenerates the scattered instances and refits the TLAS
+
+    std::vector<Deformer> deformers;
+    std::vector<SkinVertex> skin_vertices;
+    std::vector<MorphDelta> morph_deltas;
+    std::vector<glm::mat4> joint_matrices;
+    std::vector<float> morph_weights;
+
+    Buffer skin_vertex_buffer;
+    Buffer morph_delta_buffer;
+    Buffer blas_update_scratch_buffer;
+
+    std::vector<AnimationState> animation_states;
+    std::future<void> animation_job;
+    float animation_time = 0.0f;
+    float animation_speed = 1.0f;
+    bool animation_playing = true;
+
+    uint32_t load_model(const std::shared_ptr<Model>& model, uint32_t animation_state, const Context& ctx);
+    void add_deformed_nodes(AnimationState& state, uint32_t first_blas);
+    [[nodiscard]] uint32_t count_tlas_instances(const Model& model, uint32_t first_blas) const;
+    void write_tlas_instances(vk::AccelerationStructureInstanceKHR* dst) const;
+    void apply_poses();
+    // Object space error per unit of distance that projects to LOD_PIXEL_ERROR pixels from the current camera
+    [[nodiscard]] float get_lod_max_error() const;
+    // Picks the coarsest level of every LOD instance whose error stays under a pixel from the current camera
+    void update_lods();
+    // Moves the light instances of animated nodes with their TLAS instances and refits the top-level light tree
+    void record_light_update(const vk::raii::CommandBuffer& cmd, const FrameUpdateBuffers& frame_buffers);
+    void record_deformation(const Context& ctx,
+                            const vk::raii::CommandBuffer& cmd,
+                            const FrameUpdateBuffers& frame_buffers,
+                            const ComputePipeline& deform_pipeline);
+    // Rebuilds instead of refitting when instances switched to another BLAS, a refit keeps the old topology
+    void record_tlas_update(const Context& ctx, const vk::raii::CommandBuffer& cmd, bool rebuild);
+    // Copies the CPU written instances from staging to the front of the instance buffer
+    void record_instance_upload(const vk::raii::CommandBuffer& cmd, const Buffer& staging_buffer) const;
+    // Writes the scattered instances after the CPU written ones and makes them visible to the TLAS build. A non-zero
+    // lod_changed_address is set when a regenerated instance picked another level than the one it replaces
+    void record_instance_generation(const Context& ctx,
+                                    const vk::raii::CommandBuffer& cmd,
+                                    vk::DeviceAddress instance_address,
+                                    vk::DeviceAddress lod_changed_address) const;
+
+    struct BlasGeometry {
+        std::vector<vk::AccelerationStructureGeometryKHR> geometries;
+        std::vector<vk::AccelerationStructureBuildRangeInfoKHR> ranges;
+        std::vector<uint32_t> max_counts;
+    };
+
+    void build_blases_on_host(const Context& ctx, std::span<const uint32_t> blas_indices);
+    [[nodiscard]] uint64_t hash_blas_input(const Blas& blas) const;
+    void write_blas_cache(const Context& ctx,
+                          const AccelerationStructureCache& cache,
+                          std::span<const uint32_t> blas_indices,
+                          std::span<const uint64_t> keys) const;
+
+    [[nodiscard]] BlasGeometry get_blas_geometry(const Blas& blas,
+                                                 vk::DeviceAddress vertex_address,
+                                                 vk::DeviceAddress index_address,
+                                                 vk::DeviceAddress bounds_address) const;
 
 public:
     Scene() = default;
+    ~Scene();
 
     void set_camera(const Camera& camera_) {
         this->camera = camera_;
@@ -61,12 +261,50 @@ public:
     }
 
     void add_instance(const std::shared_ptr<Model>& model, const glm::mat4& transform, const Context& ctx);
+    // Instances expanded into TLAS records on the GPU, without per-instance CPU work at build or refit time
+    void add_scatter(const std::shared_ptr<Model>& model, const ScatterGrid& grid, const Context& ctx);
+    // Point, spot, rectangle or disc light in world space, picked up by the next build_light_buffer
+    void add_light(const Light& light);
 
     void build_blases(const Context& ctx);
     void build_tlas(const Context& ctx);
     void build_light_buffer(const Context& ctx);
+    // Decodes the HDRI on a worker thread while the rest of the scene loads
+    void load_environment(const std::filesystem::path& path);
+    // Waits for load_environment and uploads the map, before build_descriptor_set so it joins the bindless textures
+    void build_environment(const Context& ctx);
     void build_descriptor_set(const Context& ctx);
 
+    // Selects mesh LODs for the current camera, collects the poses sampled on the worker thread and starts
+    // sampling the next frame
+    void update(float delta);
+    // Deforms skinned and morphed meshes, refits their BLASes and the TLAS with the latest poses and LODs,
+    // must be recorded before the ray tracing dispatch
+    void record_updates(const Context& ctx,
+                        const vk::raii::CommandBuffer& cmd,
+                        uint32_t frame_index,
+                        const ComputePipeline& deform_pipeline);
+
+    [[nodiscard]] bool has_animations() const {
+        return !animation_states.empty();
+    }
+
+    [[nodiscard]] bool is_animating() const {
+        return has_animations() && animation_playing;
+    }
+
+    void set_animation_playing(const bool playing) {
+        animation_playing = playing;
+    }
+
+    void set_animation_speed(const float speed) {
+        animation_speed = speed;
+    }
+
+    [[nodiscard]] float get_animation_speed() const {
+        return animation_speed;
+    }
+
     [[nodiscard]] const AccelerationStructure& get_tlas() const {
         return tlas;
     }
@@ -83,8 +321,16 @@ public:
         return scene_ptrs;
     }
 
+    [[nodiscard]] const EnvironmentMap& get_environment_map() const {
+        return environment_map;
+    }
+
     [[nodiscard]] uint32_t get_num_lights() const {
-        return lights.size();
+        return num_lights;
+    }
+
+    [[nodiscard]] uint32_t get_num_light_instances() const {
+        return light_instances.size();
     }
 
     [[nodiscard]] const vk::raii::DescriptorSet& get_descriptor_set() const {
@@ -15,7 +15,16 @@ call :compile raytrace.rgen || exit /b 1
 call :compile raytrace.rmiss || exit /b 1
 call :compile raytrace.rchit || exit /b 1
 call :compile raytrace.rahit || exit /b 1
+call :compile raytrace.procedural.rchit || exit /b 1
+call :compile raytrace.sphere.rint || exit /b 1
+call :compile raytrace.disc.rint || exit /b 1
+call :compile raytrace.curve.rint || exit /b 1
 call :compile compute       || exit /b 1
+call :compile deform        || exit /b 1
+call :compile instances     || exit /b 1
+call :compile transmittance_lut || exit /b 1
+call :compile sky_view_lut  || exit /b 1
+call :compile guiding_refit || exit /b 1
 
 echo Done
 exit /b 0
@@ -7,7 +7,7 @@ mkdir -p "$OUTPUT_DIR"
 
 echo "Compiling shaders..."
 
-for SHADER in raytrace.rgen raytrace.rmiss raytrace.rchit raytrace.rahit compute; do
+for SHADER in raytrace.rgen raytrace.rmiss raytrace.rchit raytrace.rahit raytrace.procedural.rchit raytrace.sphere.rint raytrace.disc.rint raytrace.curve.rint compute deform instances transmittance_lut sky_view_lut guiding_refit; do
     SRC="$SHADER_DIR/$SHADER.slang"
     DST="$OUTPUT_DIR/$SHADER.spv"
 
@@ -6,6 +6,7 @@
     using float3 = glm::vec3;
     using float4 = glm::vec4;
     using float4x4 = glm::mat4;
+    using uint4 = glm::uvec4;
 
     #define P(T) uint64_t
 #else
@@ -17,6 +18,7 @@
 #define EPSILON 0.00001
 #define T_MIN 0.0
 #define T_MAX 10000.0
+#define LOD_MIN_DISTANCE 0.001f // Keeps the projected error finite for a camera inside a mesh bounding sphere
 
 struct Payload {
     float3 normal;
@@ -24,10 +26,44 @@ struct Payload {
     float3 emission;
     float depth;
     float light_area;
+    uint32_t light_instance; // UINT32_MAX when the hit instance has no emissive geometry
+    uint32_t light_index; // Relative to the first light of the light instance
     float metallic;
     float roughness;
 };
 
+// Reported by the intersection shaders of analytic primitives, in object space
+struct ProceduralAttributes {
+    float3 normal;
+    float2 uv;
+};
+
+// Hit group selected by the SBT record offset of a TLAS instance, in the order the pipeline creates them.
+// Only the alpha tested group has an any-hit shader, the analytic ones have an intersection shader each
+#define HIT_GROUP_OPAQUE 0
+#define HIT_GROUP_ALPHA_TESTED 1
+#define HIT_GROUP_SPHERE 2
+#define HIT_GROUP_DISC 3
+#define HIT_GROUP_CURVE 4
+
+// Procedural sky lookup tables, baked by a compute pre-pass whenever the sun moves.
+// The sky view table has two layers, Rayleigh and Mie, so the phase functions stay exact per ray
+#define TRANSMITTANCE_LUT_WIDTH 256
+#define TRANSMITTANCE_LUT_HEIGHT 64
+#define SKY_VIEW_LUT_WIDTH 192
+#define SKY_VIEW_LUT_HEIGHT 108
+
+// Low-discrepancy sampler tables, generated once on the CPU
+#define SOBOL_DIMENSIONS 2
+#define BLUE_NOISE_SIZE 64
+
+// Path guiding radiance cache, a hash of world space cells with an equal area grid of directions each
+#define GUIDING_CELLS 65536
+#define GUIDING_BINS_SIDE 8
+#define GUIDING_BINS (GUIDING_BINS_SIDE * GUIDING_BINS_SIDE)
+#define GUIDING_SPLAT_SCALE 16.0 // Fixed point scale of the splatted radiance, shaders only have integer atomics
+#define GUIDING_TOMBSTONE 2 // Key of an evicted cell, keys of live cells are odd
+
 struct Vertex {
     float3 position;
     float3 normal;
@@ -35,6 +71,16 @@ struct Vertex {
     float2 texcoord;
 };
 
+struct SkinVertex {
+    uint4 joints;
+    float4 weights;
+};
+
+struct MorphDelta {
+    float3 position;
+    float3 normal;
+};
+
 enum class AlphaMode : uint32_t {
     Opaque = 0,
     Mask = 1,
@@ -59,20 +105,89 @@ struct Material {
     float alpha_cutoff;
 };
 
+// Analytic primitive in object space, the hit group of its BLAS tells which shape it is
+struct ProceduralPrimitive {
+    float3 p0; // Sphere or disc center, first point of a curve segment
+    float r0; // Sphere or disc radius, half width of the curve at p0
+    float3 p1; // Disc normal, second point of a curve segment
+    float r1; // Half width of the curve at p1
+};
+
+// Analytic geometries have no vertices, index_offset and index_count select their ProceduralPrimitive range
 struct Geometry {
     uint32_t vertex_offset;
     uint32_t vertex_count;
     uint32_t index_offset;
     uint32_t index_count;
     uint32_t material_index;
+    uint32_t light_offset = UINT32_MAX; // First light of this geometry relative to the BLAS's first light
+};
+
+enum class LightType : uint32_t {
+    Triangle = 0,
+    Point = 1,
+    Spot = 2,
+    Rect = 3,
+    Disc = 4
 };
 
+// Emissive triangle in object space stored once per BLAS, or an analytic light in world space.
+// Point and spot lights sit at v0, a spot points along v1 with the cosines of its inner and outer cone in v2.xy.
+// A rectangle spans the edges v1 and v2 from its corner v0, a disc is centered at v0 with normal v1 and radius v2.x
 struct Light {
-    float3 emission;
+    float3 emission; // Radiance of area lights, intensity of point and spot lights
     float3 v0;
     float3 v1;
     float3 v2;
-    float area;
+    float area; // 0 for point and spot lights
+    LightType type;
+    uint64_t bit_trail; // Path from the BLAS light tree root to the leaf, bit i set means second child at depth i
+
+    // Textured triangles are shaded per texel like a BSDF hit, emission then holds the average over the triangle
+    // that the light trees and alias tables weigh it by
+    uint32_t emissive_texture = UINT32_MAX;
+    float3 emissive_factor;
+    float2 uv0;
+    float2 uv1;
+    float2 uv2;
+};
+
+// TLAS instance with emissive geometry, its lights are transformed to world space when sampled.
+// Every analytic light gets one of its own with an identity transform, after those of the TLAS instances
+struct LightInstance {
+    float4x4 object_to_world;
+    float4x4 world_to_object;
+    uint64_t bit_trail; // Path from the top-level light tree root to the leaf
+    uint32_t first_light;
+    uint32_t light_count;
+    uint32_t first_node; // Root of the BLAS light tree
+};
+
+// Light tree node, the first child directly follows its parent, the second child is relative to the tree root
+struct LightNode {
+    float3 bounds_min;
+    float phi; // Emitted power
+    float3 bounds_max;
+    uint32_t second_child_or_light; // Second child of an interior node, light index of a leaf
+    float3 axis; // Orientation cone of the emitter normals
+    float cos_theta_o;
+    float cos_theta_e;
+    uint32_t is_leaf;
+};
+
+// Walker alias table entry, pick the slot uniformly and keep it with `probability`, otherwise take `alias`
+struct AliasEntry {
+    float probability;
+    uint32_t alias;
+    float pmf; // Selection probability of this entry
+};
+
+// Equirectangular HDRI in the bindless textures, importance sampled by pixel
+struct EnvironmentMap {
+    P(AliasEntry) alias_table; // Pixels by luminance times solid angle, row-major from the top
+    uint32_t texture_index = UINT32_MAX; // UINT32_MAX when no HDRI is loaded
+    uint32_t width;
+    uint32_t height;
 };
 
 struct ScenePtrs {
@@ -81,6 +196,12 @@ struct ScenePtrs {
     P(Material) materials;
     P(Geometry) geometries;
     P(Light) lights;
+    P(LightNode) light_nodes; // Top-level tree over light instances, followed by one tree per emissive BLAS
+    P(LightInstance) light_instances;
+    P(uint32_t) instance_lights; // Light instance of every TLAS instance
+    P(AliasEntry) light_alias_table; // Per emissive BLAS, lights selected proportionally to their power
+    P(AliasEntry) instance_alias_table; // Light instances by power, followed by light instances by light count
+    P(ProceduralPrimitive) procedurals;
 };
 
 enum class DebugChannel : uint32_t {
@@ -106,7 +227,19 @@ enum class SamplingStrategy : uint32_t {
     UniformSampling = 0,
     ImportanceSampling = 1,
     NextEventEstimation = 2,
-    MultipleImportanceSampling = 3
+    MultipleImportanceSampling = 3,
+    RestirGi = 4 // Multiple importance sampling with the indirect light of primary hits resampled
+};
+
+enum class LightSampling : uint32_t {
+    Uniform = 0,
+    LightTree = 1,
+    Power = 2
+};
+
+enum class TriangleSampling : uint32_t {
+    Area = 0,
+    SolidAngle = 1
 };
 
 enum class EnvironmentType : uint32_t {
@@ -116,11 +249,45 @@ enum class EnvironmentType : uint32_t {
     Procedural = 3
 };
 
+enum class SampleSequence : uint32_t {
+    Random = 0,
+    Sobol = 1, // Owen-scrambled per pixel
+    BlueNoiseSobol = 2 // Owen-scrambled once, shifted per pixel by blue noise
+};
+
+struct SamplerTables {
+    P(uint32_t) sobol_matrices; // SOBOL_DIMENSIONS generator matrices of 32 direction numbers each
+    P(float) blue_noise; // BLUE_NOISE_SIZE x BLUE_NOISE_SIZE tile of ranks in [0, 1)
+};
+
 enum class Sun : uint32_t {
     None = 0,
     Enabled = 1
 };
 
+enum class RussianRoulette : uint32_t {
+    None = 0,
+    Enabled = 1
+};
+
+// Lanes start the next sample of their pixel as soon as their path ends
+enum class PathRegeneration : uint32_t {
+    None = 0,
+    Enabled = 1
+};
+
+// Reservoir resampling of direct light at primary hits, for NEE and MIS
+enum class RestirDi : uint32_t {
+    None = 0,
+    Enabled = 1
+};
+
+// Mixes the BSDF with directions learned from the radiance of earlier paths, for MIS
+enum class PathGuiding : uint32_t {
+    None = 0,
+    Enabled = 1
+};
+
 struct RenderSettings {
     DebugChannel debug_channel;
     uint32_t samples;
@@ -136,12 +303,106 @@ struct RenderSettings {
     float sun_emission;
     float sun_radius;
     float light_emission;
+    LightSampling light_sampling;
+    TriangleSampling triangle_sampling;
+    float environment_emission;
+    EnvironmentMap environment_map;
+    SampleSequence sample_sequence;
+    SamplerTables sampler_tables;
+    RussianRoulette russian_roulette;
+    PathRegeneration path_regeneration;
+    RestirDi restir_di;
+    uint32_t restir_candidates; // Initial light samples per pixel
+    PathGuiding path_guiding;
+    float guiding_cell_size; // World units
+    float guiding_probability; // Of sampling the cached distribution instead of the BSDF
+};
+
+// Light sample of a pixel kept across frames by ReSTIR DI, with the primary hit it was resampled for
+struct Reservoir {
+    float3 light_sample; // World space point on the light, the light position for delta lights
+    uint32_t light_instance; // UINT32_MAX when the reservoir holds no sample
+    uint32_t light_index;
+    float weight_sum;
+    float contribution_weight; // Unbiased contribution weight W of the selected sample
+    uint32_t M; // Candidates behind the sample, capped by the history limit
+    float3 position;
+    float3 normal;
+};
+
+// Radiance sample of a pixel kept across frames by ReSTIR GI, with the primary hit it was resampled for
+struct GiReservoir {
+    float3 sample_position; // Secondary hit the radiance leaves from, far along the ray when it escaped
+    float3 sample_normal;
+    float3 radiance; // Outgoing from the sample towards the primary hit it was traced from
+    float weight_sum;
+    float contribution_weight; // Unbiased contribution weight W of the selected sample
+    uint32_t M; // Candidates behind the sample, capped by the history limit
+    float3 position;
+    float3 normal;
 };
 
 struct PushData {
     ScenePtrs scene_ptrs;
     P(RenderSettings) render_settings;
     uint32_t frame_count;
-    uint32_t num_lights;
+    uint32_t num_lights; // Emissive triangles of all instances and analytic lights
+    uint32_t num_light_instances;
     float3 sun_dir;
+    uint32_t accumulation_limit; // 0 accumulates every frame, otherwise only the last N frames (moving scenes)
+};
+
+// Layout of VkAccelerationStructureInstanceKHR
+struct TlasInstance {
+    float4 transform[3]; // Row-major 3x4
+    uint32_t custom_index_and_mask; // Custom index in the low 24 bits, mask in the high 8 bits
+    uint32_t sbt_offset_and_flags; // SBT record offset in the low 24 bits, instance flags in the high 8 bits
+    uint64_t blas_address;
+};
+
+// Node of a model scattered on the GPU, every generated instance emits one TLAS instance per node
+struct ScatterNode {
+    float4x4 transform;
+    uint64_t blas_address;
+    uint32_t custom_index;
+    uint32_t sbt_offset;
+    uint32_t first_lod; // Into InstanceGenPushData::lods
+    uint32_t lod_count; // 0 when the BLAS has no LOD chain, the full detail level included otherwise
+    float3 lod_center; // Object space bounding sphere of the mesh
+    float lod_radius;
+};
+
+// Level of a LOD chain, picked per scattered instance while its TLAS records are generated
+struct ScatterLod {
+    uint64_t blas_address;
+    uint32_t custom_index;
+    float error; // Object space, 0 for the full detail level
+};
+
+struct InstanceGenPushData {
+    P(TlasInstance) dst_instances;
+    P(ScatterNode) nodes;
+    P(ScatterLod) lods;
+    P(uint32_t) lod_changed; // Set when an instance switched levels, 0 when the destination holds no previous records
+    float3 grid_origin;
+    float grid_spacing;
+    uint32_t grid_size; // Instances per grid axis
+    uint32_t seed;
+    uint32_t node_count;
+    uint32_t first_instance; // Of this dispatch within the scatter
+    uint32_t instance_count; // Of this dispatch
+    float3 camera_pos;
+    float lod_max_error; // Object space error per unit of distance that still projects under a pixel
+};
+
+struct DeformPushData {
+    P(Vertex) src_vertices;
+    P(Vertex) dst_vertices;
+    P(SkinVertex) skin_vertices;
+    P(MorphDelta) morph_deltas; // Target-major, morph_target_count * vertex_count
+    P(float) morph_weights;
+    P(float4x4) joint_matrices;
+    uint32_t vertex_count;
+    uint32_t morph_target_count;
+    uint32_t skinned;
 };
\ No newline at end of file
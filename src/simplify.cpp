@@ -0,0 +1,330 @@
+#include "simplify.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <unordered_map>
+
+#include <glm/gtx/hash.hpp>
+
+#include "model.h"
+
+constexpr uint32_t MIN_LOD_TRIANGLES = 32; // Levels are not generated below this many triangles per mesh
+constexpr float MIN_LOD_REDUCTION = 0.85f; // A level must keep at most this fraction of the previous one
+constexpr double BORDER_WEIGHT = 10.0; // Weight of the constraint planes along open edges
+constexpr float FLIP_COSINE = 0.2f; // Collapses may not turn a triangle normal further than this
+
+// Symmetric 4x4 matrix of a sum of squared plane distances, only the upper triangle is stored
+struct Quadric {
+    double a2 = 0.0, ab = 0.0, ac = 0.0, ad = 0.0;
+    double b2 = 0.0, bc = 0.0, bd = 0.0;
+    double c2 = 0.0, cd = 0.0;
+    double d2 = 0.0;
+
+    void add_plane(const glm::dvec3& n, const double d, const double weight) {
+        a2 += weight * n.x * n.x;
+        ab += weight * n.x * n.y;
+        ac += weight * n.x * n.z;
+        ad += weight * n.x * d;
+        b2 += weight * n.y * n.y;
+        bc += weight * n.y * n.z;
+        bd += weight * n.y * d;
+        c2 += weight * n.z * n.z;
+        cd += weight * n.z * d;
+        d2 += weight * d * d;
+    }
+
+    void add(const Quadric& q) {
+        a2 += q.a2;
+        ab += q.ab;
+        ac += q.ac;
+        ad += q.ad;
+        b2 += q.b2;
+        bc += q.bc;
+        bd += q.bd;
+        c2 += q.c2;
+        cd += q.cd;
+        d2 += q.d2;
+    }
+
+    [[nodiscard]] double evaluate(const glm::vec3& p) const {
+        const double x = p.x, y = p.y, z = p.z;
+        const double error = a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x
+                             + b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y
+                             + c2 * z * z + 2.0 * cd * z
+                             + d2;
+        return std::max(error, 0.0);
+    }
+};
+
+struct Collapse {
+    double cost;
+    uint32_t from;
+    uint32_t to;
+    uint32_t version;
+
+    bool operator>(const Collapse& other) const {
+        return cost > other.cost;
+    }
+};
+
+uint64_t edge_key(const uint32_t a, const uint32_t b) {
+    return static_cast<uint64_t>(std::min(a, b)) << 32 | std::max(a, b);
+}
+
+class Simplifier {
+    const std::vector<Vertex>& vertices;
+    std::vector<std::array<uint32_t, 3>> triangles;
+    std::vector<bool> triangle_alive;
+    std::vector<std::vector<uint32_t>> vertex_triangles;
+    std::vector<Quadric> quadrics;
+    std::vector<uint32_t> versions;
+    std::vector<bool> vertex_alive;
+    std::vector<bool> locked; // Seam vertices, attributes on both sides would be lost when moving them
+    std::vector<bool> border;
+    std::unordered_map<uint64_t, uint32_t> edge_use;
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<>> heap;
+
+    bool is_border_edge(const uint32_t a, const uint32_t b) const {
+        const auto it = edge_use.find(edge_key(a, b));
+        return it != edge_use.end() && it->second == 1;
+    }
+
+    // Moving `from` onto `to` must not fold over or collapse any triangle that survives
+    bool is_valid(const uint32_t from, const uint32_t to) const {
+        if (border[from] && !is_border_edge(from, to)) return false;
+
+        const glm::vec3& target = vertices[to].position;
+        for (const uint32_t t : vertex_triangles[from]) {
+            if (!triangle_alive[t]) continue;
+            const auto& triangle = triangles[t];
+            if (triangle[0] == to || triangle[1] == to || triangle[2] == to) continue;
+
+            glm::vec3 p[3];
+            for (int k = 0; k < 3; ++k) {
+                p[k] = vertices[triangle[k]].position;
+            }
+            const glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            for (int k = 0; k < 3; ++k) {
+                if (triangle[k] == from) p[k] = target;
+            }
+            const glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+
+            const float length_before = glm::length(before);
+            const float length_after = glm::length(after);
+            if (length_after <= 0.0f || length_before <= 0.0f) return false;
+            if (glm::dot(before, after) < FLIP_COSINE * length_before * length_after) return false;
+        }
+        return true;
+    }
+
+    void push_candidate(const uint32_t from) {
+        if (!vertex_alive[from] || locked[from]) return;
+
+        Collapse best{std::numeric_limits<double>::max(), from, UINT32_MAX, versions[from]};
+        for (const uint32_t t : vertex_triangles[from]) {
+            if (!triangle_alive[t]) continue;
+            for (const uint32_t to : triangles[t]) {
+                if (to == from) continue;
+                Quadric q = quadrics[from];
+                q.add(quadrics[to]);
+                const double cost = q.evaluate(vertices[to].position);
+                if (cost < best.cost) {
+                    best.cost = cost;
+                    best.to = to;
+                }
+            }
+        }
+        if (best.to != UINT32_MAX) heap.push(best);
+    }
+
+    void collapse(const uint32_t from, const uint32_t to) {
+        vertex_alive[from] = false;
+        quadrics[to].add(quadrics[from]);
+
+        for (const uint32_t t : vertex_triangles[from]) {
+            if (!triangle_alive[t]) continue;
+            auto& triangle = triangles[t];
+            for (auto& index : triangle) {
+                if (index == from) index = to;
+            }
+            if (triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[2] == triangle[0]) {
+                triangle_alive[t] = false;
+                --live_triangles;
+            } else {
+                vertex_triangles[to].push_back(t);
+            }
+        }
+        vertex_triangles[from].clear();
+
+        // Every vertex around the merged one has a different best collapse now
+        std::vector<uint32_t> neighbours;
+        for (const uint32_t t : vertex_triangles[to]) {
+            if (!triangle_alive[t]) continue;
+            neighbours.insert(neighbours.end(), triangles[t].begin(), triangles[t].end());
+        }
+        std::ranges::sort(neighbours);
+        neighbours.erase(std::ranges::unique(neighbours).begin(), neighbours.end());
+        for (const uint32_t v : neighbours) {
+            ++versions[v];
+            push_candidate(v);
+        }
+    }
+
+public:
+    size_t live_triangles;
+    double max_cost = 0.0;
+
+    Simplifier(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+        : vertices(vertices),
+          triangle_alive(indices.size() / 3, true),
+          vertex_triangles(vertices.size()),
+          quadrics(vertices.size()),
+          versions(vertices.size(), 0),
+          vertex_alive(vertices.size(), true),
+          locked(vertices.size(), false),
+          border(vertices.size(), false),
+          live_triangles(indices.size() / 3) {
+        triangles.resize(indices.size() / 3);
+        for (size_t t = 0; t < triangles.size(); ++t) {
+            triangles[t] = {indices[3 * t], indices[3 * t + 1], indices[3 * t + 2]};
+            for (int k = 0; k < 3; ++k) {
+                vertex_triangles[triangles[t][k]].push_back(static_cast<uint32_t>(t));
+                ++edge_use[edge_key(triangles[t][k], triangles[t][(k + 1) % 3])];
+            }
+        }
+
+        // glTF splits vertices wherever an attribute changes, those positions must stay where they are
+        std::unordered_map<glm::vec3, uint32_t> positions;
+        for (uint32_t v = 0; v < vertices.size(); ++v) {
+            if (vertex_triangles[v].empty()) continue;
+            const auto [it, inserted] = positions.try_emplace(vertices[v].position, v);
+            if (!inserted) {
+                locked[v] = true;
+                locked[it->second] = true;
+            }
+        }
+
+        for (const auto& triangle : triangles) {
+            const glm::dvec3 a = vertices[triangle[0]].position;
+            const glm::dvec3 b = vertices[triangle[1]].position;
+            const glm::dvec3 c = vertices[triangle[2]].position;
+            const glm::dvec3 cross = glm::cross(b - a, c - a);
+            const double length = glm::length(cross);
+            if (length <= 0.0) continue;
+            const glm::dvec3 n = cross / length;
+
+            for (int k = 0; k < 3; ++k) {
+                quadrics[triangle[k]].add_plane(n, -glm::dot(n, a), 1.0);
+            }
+
+            // Open edges get a plane perpendicular to the surface, so outlines do not shrink
+            for (int k = 0; k < 3; ++k) {
+                const uint32_t i0 = triangle[k];
+                const uint32_t i1 = triangle[(k + 1) % 3];
+                if (!is_border_edge(i0, i1)) continue;
+                border[i0] = true;
+                border[i1] = true;
+
+                const glm::dvec3 p0 = vertices[i0].position;
+                const glm::dvec3 p1 = vertices[i1].position;
+                const glm::dvec3 side = glm::cross(p1 - p0, n);
+                const double side_length = glm::length(side);
+                if (side_length <= 0.0) continue;
+                const glm::dvec3 m = side / side_length;
+                quadrics[i0].add_plane(m, -glm::dot(m, p0), BORDER_WEIGHT);
+                quadrics[i1].add_plane(m, -glm::dot(m, p0), BORDER_WEIGHT);
+            }
+        }
+
+        for (uint32_t v = 0; v < vertices.size(); ++v) {
+            push_candidate(v);
+        }
+    }
+
+    // Collapses the cheapest valid edges until the target is reached, false when nothing is left to collapse
+    bool simplify(const size_t target_triangles) {
+        while (live_triangles > target_triangles) {
+            if (heap.empty()) return false;
+
+            const Collapse candidate = heap.top();
+            heap.pop();
+            if (!vertex_alive[candidate.from] || candidate.version != versions[candidate.from]) continue;
+            if (!vertex_alive[candidate.to] || !is_valid(candidate.from, candidate.to)) continue;
+
+            max_cost = std::max(max_cost, candidate.cost);
+            collapse(candidate.from, candidate.to);
+        }
+        return true;
+    }
+
+    [[nodiscard]] std::vector<uint32_t> get_indices() const {
+        std::vector<uint32_t> indices;
+        indices.reserve(live_triangles * 3);
+        for (size_t t = 0; t < triangles.size(); ++t) {
+            if (!triangle_alive[t]) continue;
+            indices.insert(indices.end(), triangles[t].begin(), triangles[t].end());
+        }
+        return indices;
+    }
+};
+
+void build_mesh_lods(Mesh& mesh, const uint32_t lod_count, const float lod_ratio) {
+    for (auto& primitive : mesh.primitives) {
+        primitive.lod_indices.clear();
+    }
+    mesh.lod_errors.clear();
+
+    glm::vec3 bounds_min(std::numeric_limits<float>::max());
+    glm::vec3 bounds_max(std::numeric_limits<float>::lowest());
+    size_t triangle_count = 0;
+    for (const auto& primitive : mesh.primitives) {
+        for (const uint32_t index : primitive.indices) {
+            bounds_min = glm::min(bounds_min, primitive.vertices[index].position);
+            bounds_max = glm::max(bounds_max, primitive.vertices[index].position);
+        }
+        triangle_count += primitive.indices.size() / 3;
+    }
+    if (triangle_count == 0) return;
+    mesh.bounds_center = 0.5f * (bounds_min + bounds_max);
+    mesh.bounds_radius = 0.5f * glm::length(bounds_max - bounds_min);
+
+    // Skinned and morphed vertices move away from where the quadrics were measured
+    for (const auto& primitive : mesh.primitives) {
+        if (!primitive.skin.empty() || primitive.morph_target_count > 0) return;
+    }
+
+    std::vector<Simplifier> simplifiers;
+    simplifiers.reserve(mesh.primitives.size());
+    for (const auto& primitive : mesh.primitives) {
+        simplifiers.emplace_back(primitive.vertices, primitive.indices);
+    }
+
+    size_t previous_triangles = triangle_count;
+    float target_ratio = 1.0f;
+    for (uint32_t level = 0; level < lod_count; ++level) {
+        target_ratio *= lod_ratio;
+        if (static_cast<float>(triangle_count) * target_ratio < MIN_LOD_TRIANGLES) break;
+
+        size_t level_triangles = 0;
+        double level_cost = 0.0;
+        for (size_t i = 0; i < mesh.primitives.size(); ++i) {
+            const size_t target = static_cast<size_t>(
+                static_cast<float>(mesh.primitives[i].indices.size() / 3) * target_ratio);
+            simplifiers[i].simplify(target);
+            level_triangles += simplifiers[i].live_triangles;
+            level_cost = std::max(level_cost, simplifiers[i].max_cost);
+        }
+
+        // Primitives stuck on locked seams stop the chain once levels barely get any smaller
+        if (static_cast<float>(level_triangles) > MIN_LOD_REDUCTION * static_cast<float>(previous_triangles)) break;
+        previous_triangles = level_triangles;
+
+        for (size_t i = 0; i < mesh.primitives.size(); ++i) {
+            mesh.primitives[i].lod_indices.push_back(simplifiers[i].get_indices());
+        }
+        mesh.lod_errors.push_back(static_cast<float>(std::sqrt(level_cost)));
+    }
+}
\ No newline at end of file
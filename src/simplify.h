@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+struct Mesh;
+
+/**
+ * Chain of simplified index lists per primitive over its original vertices, built with half-edge collapses ordered
+ * by quadric error. Open and seam edges get constraint planes so outlines stay in place. Skinned and morphed
+ * meshes are left without LODs
+ * Source: Garland and Heckbert 1997, "Surface Simplification Using Quadric Error Metrics"
+ * Web: https://www.cs.cmu.edu/~garland/Papers/quadrics.pdf
+ */
+void build_mesh_lods(Mesh& mesh, uint32_t lod_count, float lod_ratio);
\ No newline at end of file
@@ -5,12 +5,15 @@
 AccelerationStructure::AccelerationStructure(const Device& device,
                                              const Allocator& allocator,
                                              const vk::AccelerationStructureBuildSizesInfoKHR& build_sizes,
-                                             const vk::AccelerationStructureTypeKHR type) {
+                                             const vk::AccelerationStructureTypeKHR type,
+                                             const bool host_build) {
+    // Host builds write the acceleration structure through host-visible memory
     buffer = BufferBuilder()
              .size(build_sizes.accelerationStructureSize)
              .usage(
                  vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
                  vk::BufferUsageFlagBits::eShaderDeviceAddress)
+             .allocation_flags(host_build ? VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT : 0)
              .build(allocator);
 
     const vk::AccelerationStructureCreateInfoKHR create_info{
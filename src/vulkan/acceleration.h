@@ -15,7 +15,8 @@ public:
     explicit AccelerationStructure(const Device& device,
                                    const Allocator& allocator,
                                    const vk::AccelerationStructureBuildSizesInfoKHR& build_sizes,
-                                   vk::AccelerationStructureTypeKHR type);
+                                   vk::AccelerationStructureTypeKHR type,
+                                   bool host_build = false);
 
     // Move only
     AccelerationStructure(const AccelerationStructure&) = delete;
@@ -0,0 +1,107 @@
+#include "acceleration_cache.h"
+
+#include <cstring>
+#include <fstream>
+
+#include <spdlog/spdlog.h>
+
+#include "adapter.h"
+#include "device.h"
+
+// Serialized header: driver UUID, compatibility UUID, serialized size, deserialized size, handle count
+constexpr size_t SERIALIZED_HEADER_SIZE = 2 * VK_UUID_SIZE + 3 * sizeof(uint64_t);
+
+uint64_t fnv1a(const std::span<const std::byte> bytes, uint64_t hash) {
+    for (const std::byte byte : bytes) {
+        hash ^= static_cast<uint64_t>(byte);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+AccelerationStructureCache::AccelerationStructureCache(const Adapter& adapter, const std::filesystem::path& root) {
+    const auto properties = adapter.get().getProperties2<
+        vk::PhysicalDeviceProperties2,
+        vk::PhysicalDeviceIDProperties
+    >();
+    const auto& device_uuid = properties.get<vk::PhysicalDeviceIDProperties>().deviceUUID;
+    const uint32_t driver_version = properties.get<vk::PhysicalDeviceProperties2>().properties.driverVersion;
+
+    std::string name;
+    for (const uint8_t byte : device_uuid) {
+        name += fmt::format("{:02x}", byte);
+    }
+    name += fmt::format("-{:08x}", driver_version);
+
+    directory = root / name;
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        spdlog::warn("Acceleration structure cache disabled, failed to create {}: {}", directory.string(), error.message());
+        directory.clear();
+    }
+}
+
+std::vector<std::byte> AccelerationStructureCache::load(const Device& device, const uint64_t key) const {
+    if (directory.empty()) return {};
+
+    std::ifstream file(directory / fmt::format("{:016x}.bin", key), std::ios::ate | std::ios::binary);
+    if (!file.is_open()) return {};
+
+    const auto size = static_cast<size_t>(file.tellg());
+    if (size < SERIALIZED_HEADER_SIZE) return {};
+
+    std::vector<std::byte> data(size);
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(size));
+    if (!file) return {};
+
+    uint64_t serialized_size;
+    memcpy(&serialized_size, data.data() + 2 * VK_UUID_SIZE, sizeof(uint64_t));
+    if (serialized_size != size) return {};
+
+    // The driver decides whether a blob it wrote earlier is still usable
+    const vk::AccelerationStructureVersionInfoKHR version_info{
+        .pVersionData = reinterpret_cast<const uint8_t*>(data.data())
+    };
+    if (device.get().getAccelerationStructureCompatibilityKHR(version_info) !=
+        vk::AccelerationStructureCompatibilityKHR::eCompatible) {
+        return {};
+    }
+
+    return data;
+}
+
+void AccelerationStructureCache::store(const uint64_t key, const std::span<const std::byte> data) const {
+    if (directory.empty()) return;
+
+    // Written next to the final name first, so an interrupted write never leaves a truncated entry behind
+    const auto path = directory / fmt::format("{:016x}.bin", key);
+    auto temp_path = path;
+    temp_path += ".tmp";
+
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        if (!file) {
+            spdlog::warn("Failed to write acceleration structure cache entry {}", path.string());
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        spdlog::warn("Failed to write acceleration structure cache entry {}: {}", path.string(), error.message());
+        std::filesystem::remove(temp_path, error);
+    }
+}
+
+vk::DeviceSize AccelerationStructureCache::get_deserialized_size(const std::span<const std::byte> data) {
+    uint64_t size = 0;
+    if (data.size() >= SERIALIZED_HEADER_SIZE) {
+        memcpy(&size, data.data() + 2 * VK_UUID_SIZE + sizeof(uint64_t), sizeof(uint64_t));
+    }
+    return size;
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <filesystem>
+#include <span>
+#include <vector>
+
+#include <vulkan/vulkan_raii.hpp>
+
+class Adapter;
+class Device;
+
+constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+
+// 64-bit FNV-1a, chained through the hash argument
+uint64_t fnv1a(std::span<const std::byte> bytes, uint64_t hash = FNV_OFFSET_BASIS);
+
+// Serialized acceleration structures on disk, one directory per device UUID and driver version,
+// one file per content hash of the build input
+class AccelerationStructureCache {
+    std::filesystem::path directory;
+
+public:
+    // Required alignment of the source address of a deserialization
+    static constexpr uint32_t SERIALIZED_ALIGNMENT = 256;
+
+    AccelerationStructureCache() = default;
+    explicit AccelerationStructureCache(const Adapter& adapter, const std::filesystem::path& root);
+
+    // Empty when missing, unreadable or incompatible with the device
+    [[nodiscard]] std::vector<std::byte> load(const Device& device, uint64_t key) const;
+    void store(uint64_t key, std::span<const std::byte> data) const;
+
+    // Size of the acceleration structure a serialized blob deserializes into
+    [[nodiscard]] static vk::DeviceSize get_deserialized_size(std::span<const std::byte> data);
+};
\ No newline at end of file
@@ -3,7 +3,8 @@
 #include "adapter.h"
 #include "device.h"
 
-Device::Device(const Adapter& adapter, const std::vector<const char*>& required_extensions) : handle(nullptr),
+Device::Device(const Adapter& adapter, const std::vector<const char*>& required_extensions, const bool host_builds)
+    : handle(nullptr),
     queue(nullptr), queue_family_index(0) {
     auto queue_family_properties = adapter.get().getQueueFamilyProperties();
 
@@ -41,6 +42,16 @@ Device::Device(const Adapter& adapter, const std::vector<const char*>& required_
         .pQueuePriorities = &queue_priority
     };
 
+    // Host builds only pay off on software implementations, where they run on the same CPUs as device ones.
+    // A GPU that also exposes them keeps building on the device unless asked otherwise
+    const bool host_commands_supported = adapter.get().getFeatures2<
+        vk::PhysicalDeviceFeatures2,
+        vk::PhysicalDeviceAccelerationStructureFeaturesKHR
+    >().get<vk::PhysicalDeviceAccelerationStructureFeaturesKHR>().accelerationStructureHostCommands;
+    const bool cpu_device = adapter.get().getProperties().deviceType == vk::PhysicalDeviceType::eCpu;
+    host_acceleration_structure_commands = host_commands_supported && (cpu_device || host_builds);
+    spdlog::info("Host acceleration structure builds: {}", host_acceleration_structure_commands ? "enabled" : "disabled");
+
     vk::StructureChain<vk::PhysicalDeviceFeatures2,
                        vk::PhysicalDeviceVulkan12Features,
                        vk::PhysicalDeviceVulkan13Features,
@@ -59,6 +70,8 @@ Device::Device(const Adapter& adapter, const std::vector<const char*>& required_
     features_chain.get<vk::PhysicalDeviceVulkan13Features>().dynamicRendering = vk::True;
     features_chain.get<vk::PhysicalDeviceVulkan14Features>().pushDescriptor = vk::True;
     features_chain.get<vk::PhysicalDeviceAccelerationStructureFeaturesKHR>().accelerationStructure = vk::True;
+    features_chain.get<vk::PhysicalDeviceAccelerationStructureFeaturesKHR>().accelerationStructureHostCommands =
+        host_acceleration_structure_commands;
     features_chain.get<vk::PhysicalDeviceRayTracingPipelineFeaturesKHR>().rayTracingPipeline = vk::True;
     features_chain.get<vk::PhysicalDeviceFeatures2>().features.shaderInt64 = vk::True;
     features_chain.get<vk::PhysicalDeviceShaderClockFeaturesKHR>().shaderDeviceClock = vk::True;
@@ -87,4 +100,8 @@ const vk::raii::Queue& Device::get_queue() const {
 
 uint32_t Device::get_queue_family_index() const {
     return queue_family_index;
+}
+
+bool Device::uses_host_acceleration_structure_builds() const {
+    return host_acceleration_structure_commands;
 }
\ No newline at end of file
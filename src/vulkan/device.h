@@ -8,10 +8,14 @@ class Device {
     vk::raii::Device handle;
     vk::raii::Queue queue;
     uint32_t queue_family_index;
+    bool host_acceleration_structure_commands = false;
 
 public:
-    explicit Device(const Adapter& adapter, const std::vector<const char*>& required_extensions);
+    // host_builds opts into host acceleration structure builds on GPUs, CPU devices use them whenever supported
+    explicit Device(const Adapter& adapter, const std::vector<const char*>& required_extensions, bool host_builds);
     const vk::raii::Device& get() const;
     const vk::raii::Queue& get_queue() const;
     uint32_t get_queue_family_index() const;
+    // Acceleration structures are built on the CPU through deferred host operations
+    bool uses_host_acceleration_structure_builds() const;
 };
@@ -81,6 +81,21 @@ RayTracingPipelineBuilder& RayTracingPipelineBuilder::hit_group(const std::optio
     return *this;
 }
 
+RayTracingPipelineBuilder& RayTracingPipelineBuilder::procedural_hit_group(const std::string& rint_path,
+                                                                           const std::optional<std::string>& rchit_path) {
+    hit_count++;
+    PendingGroup group{};
+    group.type = vk::RayTracingShaderGroupTypeKHR::eProceduralHitGroup;
+    group.intersection_idx = add_stage(rint_path, vk::ShaderStageFlagBits::eIntersectionKHR);
+
+    if (rchit_path.has_value()) {
+        group.closest_hit_idx = add_stage(rchit_path.value(), vk::ShaderStageFlagBits::eClosestHitKHR);
+    }
+
+    pending_groups.push_back(group);
+    return *this;
+}
+
 RayTracingPipelineBuilder& RayTracingPipelineBuilder::descriptor_set_layout(const vk::raii::DescriptorSetLayout& layout) {
     descriptor_set_layouts.push_back(*layout);
     return *this;
@@ -123,7 +138,7 @@ RayTracingPipeline RayTracingPipelineBuilder::build(const Device& device) const
             .generalShader = group.general_idx,
             .closestHitShader = group.closest_hit_idx,
             .anyHitShader = group.any_hit_idx,
-            .intersectionShader = vk::ShaderUnusedKHR,
+            .intersectionShader = group.intersection_idx,
         };
         group_infos.emplace_back(group_info);
     }
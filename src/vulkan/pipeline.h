@@ -75,6 +75,7 @@ class RayTracingPipelineBuilder {
         uint32_t general_idx = vk::ShaderUnusedKHR;
         uint32_t closest_hit_idx = vk::ShaderUnusedKHR;
         uint32_t any_hit_idx = vk::ShaderUnusedKHR;
+        uint32_t intersection_idx = vk::ShaderUnusedKHR;
     };
 
     std::vector<PendingStage> pending_stages;
@@ -96,6 +97,9 @@ public:
     RayTracingPipelineBuilder& rmiss_group(const std::string& path);
     RayTracingPipelineBuilder& hit_group(const std::optional<std::string>& rchit_path,
                                          const std::optional<std::string>& rahit_path);
+    // Hit group of AABB geometry, the intersection shader decides where the ray hits the primitive
+    RayTracingPipelineBuilder& procedural_hit_group(const std::string& rint_path,
+                                                    const std::optional<std::string>& rchit_path);
 
     RayTracingPipelineBuilder& descriptor_set_layout(const vk::raii::DescriptorSetLayout& layout);
     RayTracingPipelineBuilder& push_constant_range(vk::PushConstantRange range);